@@ -2,6 +2,7 @@ import re
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import uart
+from esphome.core import CORE, ID, coroutine_with_priority
 from esphome.const import (
     CONF_ID,
     CONF_RECEIVE_TIMEOUT,
@@ -9,6 +10,7 @@ from esphome.const import (
 )
 
 CODEOWNERS = ["@aquaticus"]
+DOMAIN = "iec62056"
 
 DEPENDENCIES = ["uart"]
 AUTO_LOAD = ["sensor", "text_sensor", "switch", "binary_sensor"]
@@ -18,32 +20,148 @@ CONF_BATTERY_METER = "battery_meter"
 CONF_RETRY_COUNTER_MAX = "retry_counter_max"
 CONF_RETRY_DELAY = "retry_delay"
 CONF_MODE_D = "mode_d"  # protocol mode D
+CONF_TELEGRAM_CRC = "telegram_crc"  # mode D telegrams end with CRC16 (DSMR/P1)
+CONF_MODE_E = "mode_e"  # HDLC when the meter offers protocol mode E
 CONF_BAUD_RATE_MAX = "baud_rate_max"
+CONF_PROTOCOL_TASK = "protocol_task"
+CONF_KEEP_SESSION = "keep_session"
+CONF_KEEP_ALIVE_INTERVAL = "keep_alive_interval"
+CONF_READOUT_MODE = "readout_mode"
+# load profile, read with R5 command
+LOAD_PROFILE_OBIS = "P.01"
 
 iec62056_ns = cg.esphome_ns.namespace("iec62056")
 IEC62056Component = iec62056_ns.class_(
     "IEC62056Component", cg.Component, uart.UARTDevice
 )
+ReadoutMode = iec62056_ns.enum("ReadoutMode")
+READOUT_MODES = {
+    "registers": ReadoutMode.READOUT_MODE_REGISTERS,
+    "data": ReadoutMode.READOUT_MODE_DATA,
+    "auto": ReadoutMode.READOUT_MODE_AUTO,
+}
+
+
+# letters in value groups, e.g. C.1.0 is 96.1.0
+OBIS_LETTERS = {"C": 96, "F": 97, "L": 98, "P": 99}
+
+
+def normalize_obis(value):
+    """Canonical (A, B, C, D, E, F) of OBIS code, the same as ObisCode::parse().
+
+    1.8.0, 1-0:1.8.0*255 and 010800FF are the same register. A and B are None
+    when not given and match any medium and channel. Missing E is 0 and
+    missing F is 255.
+    """
+    if re.fullmatch(r"[\dA-Fa-f]{8}", value):
+        return (None, None, *(int(value[i : i + 2], 16) for i in range(0, 8, 2)))
+
+    m = re.fullmatch(r"(?:(\d+)-(\d+):)?([^*]+)(?:\*(\d+))?", value)
+    if m is None:
+        raise cv.Invalid(f"Invalid OBIS format: '{value}'")
+    a, b, groups, f = m.groups()
+    groups = groups.split(".")
+    if not 2 <= len(groups) <= 3:
+        raise cv.Invalid(f"OBIS code '{value}' must have 2 or 3 value groups")
+    values = []
+    for group in groups:
+        if group in OBIS_LETTERS:
+            values.append(OBIS_LETTERS[group])
+        elif group.isdigit():
+            values.append(int(group))
+        else:
+            raise cv.Invalid(f"Invalid value group '{group}' in OBIS code '{value}'")
+    values += [0] * (3 - len(values))
+    code = (
+        None if a is None else int(a),
+        None if b is None else int(b),
+        *values,
+        255 if f is None else int(f),
+    )
+    if any(v is not None and v > 255 for v in code):
+        raise cv.Invalid(f"OBIS code '{value}' has a value group above 255")
+    return code
 
 
 def validate_obis(value):
-    # match, e.g.
+    # the same grammar as ObisCode::parse(), e.g.
     # F.35.90*00
     # F.35
     # 0.2.2
     # 0-0:1.0.0*102
     # C.P.5
-    # Allow any uppercase alphanumeric character in the OBIS code
-    # rx = r"(\d+-\d+\:){,1}[\dA-Z]+\.[\dA-Z]+(.[\dA-Z]+){,1}(\*\d+){,1}"
-    rx = r"(\d+-\d+\:)?[\dA-F]+(\.[\dA-F]+)*(\*\d+)?|[\dA-F]{8}"
+    # 010800FF
+    group = r"(\d+|[CFLP])"
+    rx = rf"(\d+-\d+:)?{group}(\.{group}){{1,2}}(\*\d+)?|[\dA-Fa-f]{{8}}"
+
+    if value == LOAD_PROFILE_OBIS:
+        return value
 
     m = re.fullmatch(rx, value)
     if m is None:
-        raise cv.Invalid(f"Invalid OBIS format: '{value}'")
+        raise cv.Invalid(
+            f"Invalid OBIS code '{value}'. Expected [A-B:]C.D[.E][*F] where C, D and E "
+            "are numbers or one of the letters C, F, L, P, or 8 hex digits"
+        )
+    normalize_obis(value)
 
     return value
 
 
+def _component_data(component_id):
+    return CORE.data.setdefault(DOMAIN, {}).setdefault(
+        str(component_id), {CONF_UPDATE_INTERVAL: None, "registers": {}}
+    )
+
+
+def _interval_ms(value):
+    # update_interval returns an int for "never"
+    return value if isinstance(value, int) else value.total_milliseconds
+
+
+def _readout_frame(obis):
+    """SOH R1 STX <obis>() ETX BCC"""
+    frame = [0x01, ord("R"), ord("1"), 0x02, *obis.encode("ascii"), ord("("), ord(")"), 0x03]
+    bcc = 0
+    for b in frame[1:]:
+        bcc ^= b
+    return frame + [bcc]
+
+
+@coroutine_with_priority(-100.0)
+async def _add_registers(component, component_id, data):
+    # runs after all sensors registered their OBIS codes
+    default = _interval_ms(data[CONF_UPDATE_INTERVAL])
+    for index, (obis, intervals) in enumerate(data["registers"].values()):
+        interval = min(default if i is None else _interval_ms(i) for i in intervals)
+        if obis == LOAD_PROFILE_OBIS:
+            # request is built at runtime, it starts after the last row read
+            cg.add(component.add_request_obis(obis, interval, cg.nullptr, 0))
+            continue
+        frame = _readout_frame(obis)
+        frame_var = cg.static_const_array(
+            ID(f"{component_id}_r1_{index}", is_declaration=True, type=cg.uint8), frame
+        )
+        cg.add(component.add_request_obis(obis, interval, frame_var, len(frame)))
+
+
+def register_request_obis(component, config):
+    """Adds OBIS code of a sensor to registers read by the component.
+
+    Each code is read once, at the shortest update interval of sensors using it.
+    Sensors without update_interval use the interval of the component.
+    """
+    component_id = config[CONF_IEC62056_ID]
+    data = _component_data(component_id)
+    registers = data["registers"]
+    if not registers:
+        CORE.add_job(_add_registers, component, str(component_id), data)
+    # different forms of the same code are read once, in the form used first
+    obis = config[CONF_OBIS]
+    key = obis if obis == LOAD_PROFILE_OBIS else normalize_obis(obis)
+    registers.setdefault(key, (obis, []))[1].append(config.get(CONF_UPDATE_INTERVAL))
+
+
 def validate_baud_rate(value):
     if value > 0:
         baud_rates = [300, 600, 1200, 2400, 4800, 9600, 19200]
@@ -53,6 +171,22 @@ def validate_baud_rate(value):
     return value
 
 
+def validate_telegram_crc(config):
+    # baud rate of mode D is set by uart, e.g. 115200 for P1 ports
+    if config[CONF_TELEGRAM_CRC] and not config[CONF_MODE_D]:
+        raise cv.Invalid(f"'{CONF_TELEGRAM_CRC}' requires '{CONF_MODE_D}'")
+    return config
+
+
+def validate_keep_session(config):
+    # data readout ends programming mode, the kept session would be left without break command
+    if config[CONF_KEEP_SESSION] and config[CONF_READOUT_MODE] != "registers":
+        raise cv.Invalid(
+            f"'{CONF_KEEP_SESSION}' requires '{CONF_READOUT_MODE}: registers'"
+        )
+    return config
+
+
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
@@ -60,18 +194,28 @@ CONFIG_SCHEMA = cv.All(
             cv.Optional(CONF_UPDATE_INTERVAL, default="15min"): cv.update_interval,
             cv.Optional(CONF_BAUD_RATE_MAX, default=9600): validate_baud_rate,
             cv.Optional(CONF_BATTERY_METER, default=False): cv.boolean,
-            cv.Optional(
-                CONF_RECEIVE_TIMEOUT, default="3s"
-            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_RECEIVE_TIMEOUT): cv.positive_time_period_milliseconds,
             cv.Optional(CONF_RETRY_COUNTER_MAX, default=2): cv.int_range(min=0, max=9),
             cv.Optional(
                 CONF_RETRY_DELAY, default="15s"
             ): cv.positive_time_period_milliseconds,
             cv.Optional(CONF_MODE_D, default=False): cv.boolean,
+            cv.Optional(CONF_TELEGRAM_CRC, default=False): cv.boolean,
+            cv.Optional(CONF_MODE_E, default=False): cv.boolean,
+            cv.Optional(CONF_PROTOCOL_TASK): cv.All(cv.boolean, cv.only_on_esp32),
+            cv.Optional(CONF_READOUT_MODE, default="registers"): cv.enum(
+                READOUT_MODES, lower=True
+            ),
+            cv.Optional(CONF_KEEP_SESSION, default=False): cv.boolean,
+            cv.Optional(
+                CONF_KEEP_ALIVE_INTERVAL, default="30s"
+            ): cv.positive_time_period_milliseconds,
         }
     )
     .extend(cv.COMPONENT_SCHEMA)
-    .extend(uart.UART_DEVICE_SCHEMA)
+    .extend(uart.UART_DEVICE_SCHEMA),
+    validate_telegram_crc,
+    validate_keep_session,
 )
 
 
@@ -82,6 +226,9 @@ async def to_code(config):
 
     if CONF_UPDATE_INTERVAL in config:
         cg.add(var.set_update_interval(config[CONF_UPDATE_INTERVAL]))
+        _component_data(config[CONF_ID])[CONF_UPDATE_INTERVAL] = config[
+            CONF_UPDATE_INTERVAL
+        ]
 
     if CONF_BAUD_RATE_MAX in config:
         cg.add(var.set_config_baud_rate_max(config[CONF_BAUD_RATE_MAX]))
@@ -100,3 +247,21 @@ async def to_code(config):
 
     if CONF_MODE_D in config:
         cg.add(var.set_mode_d(config[CONF_MODE_D]))
+
+    if CONF_TELEGRAM_CRC in config:
+        cg.add(var.set_mode_d_crc(config[CONF_TELEGRAM_CRC]))
+
+    if CONF_MODE_E in config:
+        cg.add(var.set_mode_e(config[CONF_MODE_E]))
+
+    if CONF_PROTOCOL_TASK in config:
+        cg.add(var.set_protocol_task(config[CONF_PROTOCOL_TASK]))
+
+    if CONF_READOUT_MODE in config:
+        cg.add(var.set_readout_mode(config[CONF_READOUT_MODE]))
+
+    if CONF_KEEP_SESSION in config:
+        cg.add(var.set_keep_session(config[CONF_KEEP_SESSION]))
+
+    if CONF_KEEP_ALIVE_INTERVAL in config:
+        cg.add(var.set_keep_alive_interval(config[CONF_KEEP_ALIVE_INTERVAL]))
@@ -9,58 +9,70 @@
 namespace esphome {
 namespace iec62056 {
 
-static const uint8_t ETX = 0x03;
-static const uint8_t STX = 0x02;
-static const uint8_t ACK = 0x06;
-static const uint8_t SOH = 0x01;
-
 static const char *const TAG = "iec62056.component";
 const uint32_t BAUDRATES[] = {300, 600, 1200, 2400, 4800, 9600, 19200};
 #define MAX_BAUDRATE (BAUDRATES[sizeof(BAUDRATES) / sizeof(uint32_t) - 1])
 #define PROTO_B_MIN_BAUDRATE (BAUDRATES[1])
 
-const char *IEC62056Component::obis_codes_[] = {
-    "0F0880FF",     // Active energy totals
-
-    // Power total and per phase
-    "100700FF",    // Current power total
-    "240700FF",    // Current power phase 1
-    "380700FF",    // Current power phase 2
-    "4C0700FF",    // Current power phase 3
-
-    // Temperature
-    "600900FF",
-
-    // Voltage per phase
-    "200700FF",   // Voltage phase 1
-    "340700FF",   // Voltage phase 2
-    "480700FF",   // Voltage phase 3
-
-    // Current per phase
-    "1F0700FF",   // Current phase 1
-    "330700FF",   // Current phase 2
-    "470700FF",   // Current phase 3
+/// Standard baud rate below @a bps or 0 if none
+static uint32_t lower_baud_rate(uint32_t bps) {
+  uint32_t lower = 0;
+  for (uint32_t rate : BAUDRATES) {
+    if (rate < bps) {
+      lower = rate;
+    }
+  }
+  return lower;
+}
 
-    // Active power coefficient
-    "0D07FFFF",
-};
-const size_t IEC62056Component::num_obis_codes_ = sizeof(IEC62056Component::obis_codes_) / sizeof(IEC62056Component::obis_codes_[0]);
+/// Standard baud rate above @a bps or @a bps if none
+static uint32_t higher_baud_rate(uint32_t bps) {
+  for (uint32_t rate : BAUDRATES) {
+    if (rate > bps) {
+      return rate;
+    }
+  }
+  return bps;
+}
 
+/// XOR of @a size bytes. Used to verify BCC of constant frames at compile time.
+static constexpr uint8_t frame_bcc(const uint8_t *data, size_t size) {
+  return size == 0 ? 0 : data[0] ^ frame_bcc(data + 1, size - 1);
+}
 
-IEC62056Component::IEC62056Component() : current_obis_index_(0) {
+static constexpr uint8_t ID_REQUEST[] = {'/', '?', '!', '\r', '\n'};
+/// Option select, the baud rate char is replaced before sending
+static constexpr uint8_t OPTION_SELECT[] = {ACK, '0', '0', '1', '\r', '\n'};
+static constexpr uint8_t SET_PASSWORD[] = {SOH, 'P', '1', STX, '(', '0', '0', '0', '0', '0', '0', '0', '0', ')', ETX, 0x61};
+static_assert(frame_bcc(SET_PASSWORD + 1, sizeof(SET_PASSWORD) - 2) == SET_PASSWORD[sizeof(SET_PASSWORD) - 1],
+              "Invalid BCC");
+/// Break command, ends programming mode
+static constexpr uint8_t BREAK_COMMAND[] = {SOH, 'B', '0', ETX, 0x71};
+static_assert(frame_bcc(BREAK_COMMAND + 1, sizeof(BREAK_COMMAND) - 2) == BREAK_COMMAND[sizeof(BREAK_COMMAND) - 1],
+              "Invalid BCC");
+/// Partial block received correctly, send the next one
+static constexpr uint8_t ACK_BLOCK[] = {ACK};
+/// Partial block received with BCC error, repeat it
+static constexpr uint8_t NAK_BLOCK[] = {NAK};
+/// 84 NULs at 300 bps, 10 bits per character, take ~2.8s
+static constexpr uint8_t WAKEUP_SEQUENCE[84] = {};
+
+IEC62056Component::IEC62056Component() {
   state_ = INFINITE_WAIT;
 }
 
 void IEC62056Component::setup() {
   ESP_LOGCONFIG(TAG, "Setting up iec62056 component...");
 
-  update_last_transmission_from_meter_timestamp_();
 #ifdef USE_ESP32_FRAMEWORK_ARDUINO
   iuart_ = make_unique<IEC62056UART>(*static_cast<uart::ESP32ArduinoUARTComponent *>(this->parent_));
 #endif
 
 #ifdef USE_ESP_IDF
   iuart_ = make_unique<IEC62056UART>(*static_cast<uart::IDFUARTComponent *>(this->parent_));
+  if (iuart_->install_event_queue()) {
+    ESP_LOGD(TAG, "UART event driven reception enabled");
+  }
 #endif
 
 #if USE_ESP8266
@@ -68,22 +80,79 @@ void IEC62056Component::setup() {
 #endif
 
   clear_uart_input_buffer_();
+  baud_rate_ = this->parent_->get_baud_rate();
+  inter_char_timeout_ms_ = INTER_CHAR_TIMEOUT_MS + chars_time_ms_(1);
+
+  if (!force_mode_d_) {
+    baud_rate_pref_ = global_preferences->make_preference<uint32_t>(fnv1_hash("iec62056_baud_rate"));
+    uint32_t bps;
+    if (baud_rate_pref_.load(&bps) && std::count(std::begin(BAUDRATES), std::end(BAUDRATES), bps) > 0) {
+      ESP_LOGD(TAG, "Restored learned baud rate %u bps", bps);
+      learned_baud_rate_bps_ = bps;
+    }
+
+    if (profile_sensor_) {
+      profile_cursor_pref_ = global_preferences->make_preference<ProfileCursor>(fnv1_hash("iec62056_profile"));
+      if (profile_cursor_pref_.load(&profile_cursor_)) {
+        profile_cursor_.timestamp[PROFILE_TIMESTAMP_LEN] = 0;
+        ESP_LOGD(TAG, "Load profile continues after '%s'", profile_cursor_.timestamp);
+      } else {
+        profile_cursor_ = {};
+      }
+      published_profile_cursor_ = profile_cursor_;
+    }
+
+    meter_cache_pref_ = global_preferences->make_preference<MeterCache>(fnv1_hash("iec62056_meter"));
+    if (meter_cache_pref_.load(&meter_cache_) && meter_cache_.identification[0] != 0) {
+      meter_cache_.identification[sizeof(meter_cache_.identification) - 1] = 0;
+      meter_identification_ = meter_cache_.identification;
+      mode_ = (ProtocolMode) meter_cache_.mode;
+      baud_rate_identification_ = meter_cache_.baud_rate_identification;
+      password_required_ = meter_cache_.password_required;
+      meter_cache_valid_ = true;
+      ESP_LOGD(TAG, "Restored meter '%s', protocol %c", meter_identification_.c_str(), (char) mode_);
+    }
+  }
 
   if (force_mode_d_) {
+    // the meter pushes mostly the same values
+    value_hashes_.resize(sensors_.size());
     ESP_LOGI(TAG, "Mode D. Continuously reading data");
     set_next_state_(MODE_D_WAIT);
   } else if (is_periodic_readout_enabled_()) {
-    wait_(15000, BEGIN);  // Start the first readout 15s from now
+    if (meter_cache_valid_) {
+      ESP_LOGD(TAG, "Known meter. The first readout starts now.");
+      set_next_state_(BEGIN);
+    } else {
+      wait_(15000, BEGIN);  // Start the first readout 15s from now
+    }
   } else {
     ESP_LOGI(TAG, "No periodic readouts (update_interval=never). Only switch can trigger readout.");
     set_next_state_(INFINITE_WAIT);
   }
+
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    values_received_.resize(sensors_.size());
+    if (xTaskCreatePinnedToCore(protocol_task_fn_, "iec62056", PROTOCOL_TASK_STACK_SIZE, this,
+                                PROTOCOL_TASK_PRIORITY, &protocol_task_handle_, portNUM_PROCESSORS - 1) == pdPASS) {
+      ESP_LOGI(TAG, "Protocol task started");
+    } else {
+      ESP_LOGE(TAG, "Cannot start protocol task. Running protocol in loop().");
+      protocol_task_ = false;
+    }
+  }
+#endif
 }
 
 void IEC62056Component::dump_config() {
   ESP_LOGCONFIG(TAG, "IEC62056:");
   LOG_UPDATE_INTERVAL(this);
-  ESP_LOGCONFIG(TAG, "  Connection timeout: %.3fs", this->connection_timeout_ms_ / 1000.0f);
+  if (this->connection_timeout_ms_ > 0) {
+    ESP_LOGCONFIG(TAG, "  Connection timeout: %.3fs", this->connection_timeout_ms_ / 1000.0f);
+  } else {
+    ESP_LOGCONFIG(TAG, "  Connection timeout: derived from baud rate");
+  }
   if (!force_mode_d_) {
     // These settings are not used in Mode D
     ESP_LOGCONFIG(TAG, "  Battery meter: %s", YESNO(this->battery_meter_));
@@ -94,8 +163,38 @@ void IEC62056Component::dump_config() {
     }
     ESP_LOGCONFIG(TAG, "  Max retries: %u", this->max_retries_);
     ESP_LOGCONFIG(TAG, "  Retry delay: %.3fs", this->retry_delay_ / 1000.0f);
+    ESP_LOGCONFIG(TAG, "  Keep session: %s", YESNO(this->keep_session_));
+    if (this->keep_session_) {
+      ESP_LOGCONFIG(TAG, "  Keep-alive interval: %.3fs", this->keep_alive_interval_ms_ / 1000.0f);
+    }
   }
   ESP_LOGCONFIG(TAG, "  Mode D: %s", YESNO(this->force_mode_d_));
+  if (force_mode_d_) {
+    ESP_LOGCONFIG(TAG, "  Telegram CRC: %s", YESNO(this->mode_d_crc_));
+  }
+  if (!force_mode_d_) {
+    ESP_LOGCONFIG(TAG, "  Mode E: %s", YESNO(this->mode_e_enabled_));
+  }
+  if (!force_mode_d_) {
+    ESP_LOGCONFIG(TAG, "  Registers: %u", (unsigned) this->registers_.size());
+    for (const auto &r : this->registers_) {
+      if (r.interval_ms == UINT32_MAX) {
+        ESP_LOGCONFIG(TAG, "    %s, switch only", r.obis.c_str());
+      } else {
+        ESP_LOGCONFIG(TAG, "    %s, every %.3fs", r.obis.c_str(), r.interval_ms / 1000.0f);
+      }
+    }
+  }
+  ESP_LOGCONFIG(TAG, "  Protocol task: %s", YESNO(this->protocol_task_));
+  if (!force_mode_d_) {
+    const char *mode = "registers";
+    if (readout_mode_ == READOUT_MODE_DATA) {
+      mode = "data";
+    } else if (readout_mode_ == READOUT_MODE_AUTO) {
+      mode = "auto";
+    }
+    ESP_LOGCONFIG(TAG, "  Readout mode: %s", mode);
+  }
 
   ESP_LOGCONFIG(TAG, "  Sensors:");
   for (const auto &item : sensors_) {
@@ -144,105 +243,123 @@ std::string format_hex_ascii_pretty(const uint8_t *data, size_t length) {
   return std::string(final_buf);
 }
 
-void IEC62056Component::send_frame_() {
-  this->write_array(out_buf_, data_out_size_);
-  std::string hex_str = format_hex_pretty(out_buf_, data_out_size_);
-  std::string ascii_str = format_ascii_pretty(out_buf_, data_out_size_);
-  ESP_LOGVV(TAG, "TX: %s |%s|", hex_str.c_str(), ascii_str.c_str());
+void IEC62056Component::send_frame_(const uint8_t *data, size_t size) {
+  this->write_array(data, size);
+  iuart_->tx_started();
+  tx_frame_ = data;
+  last_tx_size_ = size;
+  ESP_LOGVV(TAG, "TX: %s", format_hex_ascii_pretty(data, size).c_str());
 }
 
 
 size_t IEC62056Component::receive_frame_() {
   const uint32_t max_while_ms = 15;
-  size_t ret_val;
-  auto count = this->available();
-  if (count <= 0)
-    return 0;
-
+  size_t frame_size;
   uint32_t while_start = millis();
-  uint8_t *p;
-  while (count > 0) {
-    // Make sure loop() is <30 ms
-    if (millis() - while_start > max_while_ms) {
+  // data lines are parsed while bytes arrive
+  const bool tokenize = is_data_state_();
+  while (true) {
+    if (rx_chunk_pos_ == rx_chunk_size_) {
+      // drain whatever the driver has already buffered in one call
+      rx_chunk_pos_ = 0;
+      rx_chunk_size_ = iuart_->read_available(rx_chunk_, RX_CHUNK_SIZE);
+      if (rx_chunk_size_ == 0) {
+        // nothing buffered, return at once and check the gap since the last byte
+        if (frame_.size() > 0 && millis() - last_rx_timestamp_ >= inter_char_timeout_ms_) {
+          ESP_LOGV(TAG, "Inter-character timeout. Discarding incomplete frame (%u bytes)", (unsigned) frame_.size());
+          frame_.reset();
+          reset_tokenizer_();
+        }
+        return 0;
+      }
+      last_rx_timestamp_ = millis();
+      session_rx_bytes_ += rx_chunk_size_;
+    }
+
+    // Make sure loop() is <30 ms. Protocol task is not limited by loop() time.
+    if (!protocol_task_ && millis() - while_start > max_while_ms) {
       return 0;
     }
 
-    if (data_in_size_ < MAX_IN_BUF_SIZE) {
-      p = &in_buf_[data_in_size_];
-      if (!iuart_->read_one_byte(p)) {
-        return 0;
+    uint8_t c = rx_chunk_[rx_chunk_pos_++];
+    FrameEnd end = frame_.push(c);
+    TokenEvent token = TOKEN_NONE;
+    if (tokenize) {
+      token = tokenizer_.feed(c);
+      if (telegram_crc_pending_) {
+        // mode D telegram CRC covers bytes up to '!' inclusive
+        telegram_crc_ = crc16_arc_update(telegram_crc_, c);
+        telegram_crc_pending_ = c != '!';
       }
-      data_in_size_++;
-    } else {
-      memmove(in_buf_, in_buf_ + 1, data_in_size_ - 1);
-      p = &in_buf_[data_in_size_ - 1];
-      if (!iuart_->read_one_byte(p)) {
-        return 0;
+      // BCC covers all bytes after STX including ETX/EOT, in_buf_ may hold only the tail of a long line
+      if (FRAME_ETX != end && FRAME_EOT != end) {
+        lrc_ ^= c;
       }
     }
-
-    // Check for ACK
-    if (in_buf_[data_in_size_ - 1] == ACK) {
-      ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, data_in_size_).c_str());
-      ESP_LOGV(TAG, "Detected ACK");
-      update_last_transmission_from_meter_timestamp_();
-      ret_val = data_in_size_;
-      data_in_size_ = 0;
-      return ret_val;
+    if (FRAME_NONE == end) {
+      if (TOKEN_NONE != token) {
+        process_token_(token);
+      }
+      continue;
     }
 
-    // it is not possible to have \r\n and ETX in buffer at one time
-    if (data_in_size_ >= 2 && ETX == in_buf_[data_in_size_ - 2]) {
-      std::string hex_str = format_hex_pretty(in_buf_, data_in_size_);
-      std::string ascii_str = format_ascii_pretty(in_buf_, data_in_size_);
-      ESP_LOGVV(TAG, "RX: %s |%s|", hex_str.c_str(), ascii_str.c_str());
-      ESP_LOGV(TAG, "Detected ETX");
+    // the frame is complete, make it available in in_buf_
+    frame_size = frame_.linearize();
+    frame_.reset();
 
-      readout_lrc_ = in_buf_[data_in_size_ - 1];
-      ESP_LOGV(TAG, "BCC: 0x%02x", readout_lrc_);
+    switch (end) {
+      case FRAME_ACK:
+        ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, frame_size).c_str());
+        ESP_LOGV(TAG, "Detected ACK");
+        break;
 
-      update_last_transmission_from_meter_timestamp_();
-      ret_val = data_in_size_;
-      data_in_size_ = 0;
-      return ret_val;
-    }
+      case FRAME_ETX: {
+        std::string hex_str = format_hex_pretty(in_buf_, frame_size);
+        std::string ascii_str = format_ascii_pretty(in_buf_, frame_size);
+        ESP_LOGVV(TAG, "RX: %s |%s|", hex_str.c_str(), ascii_str.c_str());
+        ESP_LOGV(TAG, "Detected ETX");
 
-    if (STX == in_buf_[data_in_size_ - 1]) {
-      ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, data_in_size_).c_str());
-      ESP_LOGV(TAG, "Detected STX");
-      reset_lrc_();
-      update_last_transmission_from_meter_timestamp_();
-      ret_val = data_in_size_;
-      data_in_size_ = 0;
-      return ret_val;
-    }
+        readout_lrc_ = in_buf_[frame_size - 1];
+        ESP_LOGV(TAG, "BCC: 0x%02x", readout_lrc_);
+        break;
+      }
 
-    if (data_in_size_ >= 2 && '\r' == in_buf_[data_in_size_ - 2] && '\n' == in_buf_[data_in_size_ - 1]) {
-      ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, data_in_size_).c_str());
+      case FRAME_EOT:
+        ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, frame_size).c_str());
+        ESP_LOGV(TAG, "Detected EOT");
+        readout_lrc_ = in_buf_[frame_size - 1];
+        ESP_LOGV(TAG, "Block BCC: 0x%02x", readout_lrc_);
+        break;
 
-      // check echo
-      if (data_in_size_ == data_out_size_ && 0 == memcmp(out_buf_, in_buf_, data_out_size_)) {
-        data_out_size_ = data_in_size_ = 0;
-        ESP_LOGVV(TAG, "Echo. Ignore frame.");
-        return 0;
-      }
+      case FRAME_STX:
+        ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, frame_size).c_str());
+        ESP_LOGV(TAG, "Detected STX");
+        reset_lrc_();
+        break;
+
+      default:  // FRAME_CRLF
+        ESP_LOGVV(TAG, "RX: %s", format_hex_ascii_pretty(in_buf_, frame_size).c_str());
+
+        // check echo
+        if (tx_frame_ && frame_size == last_tx_size_ && 0 == memcmp(tx_frame_, in_buf_, last_tx_size_)) {
+          tx_frame_ = nullptr;
+          ESP_LOGVV(TAG, "Echo. Ignore frame.");
+          return 0;
+        }
+        break;
+    }
 
-      update_last_transmission_from_meter_timestamp_();
-      ret_val = data_in_size_;
-      data_in_size_ = 0;
-      return ret_val;
+    if (TOKEN_LINE_END == token && !profile_readout_) {
+      update_line_sensors_(TextSpan((const char *) in_buf_, frame_size >= 2 ? frame_size - 2 : 0));
+    } else if (TOKEN_NONE != token) {
+      process_token_(token);
     }
+
+    return frame_size;
   }
-  return 0;
 }
 
-void IEC62056Component::send_battery_wakeup_sequence_() {
-  const size_t n = 84;  //~2.24s
-  static_assert(n <= MAX_OUT_BUF_SIZE, "Out buffer too small");
-  memset(out_buf_, 0, n);
-  data_out_size_ = n;
-  send_frame_();
-}
+void IEC62056Component::send_battery_wakeup_sequence_() { send_frame_(WAKEUP_SEQUENCE, sizeof(WAKEUP_SEQUENCE)); }
 
 char *IEC62056Component::get_id_(size_t frame_size) {
   uint8_t *p = &in_buf_[frame_size - 1 - 2 /*\r\n*/];
@@ -319,6 +436,15 @@ void IEC62056Component::connection_status_(bool connected) {
   } else {
     ESP_LOGD(TAG, "Connection end");
   }
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    ReadoutRecord record;
+    record.type = ReadoutRecord::CONNECTION;
+    record.connected = connected;
+    push_record_(record);
+    return;
+  }
+#endif
 #ifdef USE_BINARY_SENSOR
   if (readout_status_sensor_) {
     readout_status_sensor_->publish_state(connected);
@@ -332,68 +458,267 @@ void IEC62056Component::parse_id_(const char *packet) {
   baud_rate_identification_ = len >= 5 ? packet[4] : 0 /*set proto A, baud rate=0*/;
   ESP_LOGVV(TAG, "Baudrate char: '%c'", baud_rate_identification_);
   set_protocol_(baud_rate_identification_);
-  if (len >= 7 && packet[5] == '\\' && packet[6] == '2') // /XXXZ\2Ident
-  {                                    
-      ESP_LOGD(TAG, "The meter is indicating mode E, which is unsupported. Attempting mode C. " 
+  mode_e_offered_ = len >= 7 && packet[5] == '\\' && packet[6] == '2';  // /XXXZ\2Ident
+  if (mode_e_offered_) {
+    if (mode_e_enabled_) {
+      ESP_LOGD(TAG, "The meter is indicating mode E. Using HDLC.");
+    } else {
+      ESP_LOGD(TAG, "The meter is indicating mode E, which is disabled. Attempting mode C. "
                     "This will work for meters supporting both mode E and C.");
+    }
   }
 }
 
-void IEC62056Component::build_readout_command_(const char *obis_code) {
-  // Build the readout command for the given OBIS code
-  // Format: SOH R1 STX [OBIS code] ( ) ETX BCC
+void IEC62056Component::update_baudrate_(uint32_t baudrate) {
+  ESP_LOGV(TAG, "Baudrate set to: %u bps", baudrate);
+  iuart_->update_baudrate(baudrate);
+  baud_rate_ = baudrate;
+  inter_char_timeout_ms_ = INTER_CHAR_TIMEOUT_MS + chars_time_ms_(1);
+}
+
+uint32_t IEC62056Component::chars_time_ms_(size_t chars) const {
+  if (baud_rate_ == 0) {
+    return 0;
+  }
+  return (chars * BITS_PER_CHAR * 1000 + baud_rate_ - 1) / baud_rate_;
+}
+
+uint32_t IEC62056Component::state_timeout_ms_(CommState state) const {
+  switch (state) {
+    case GET_IDENTIFICATION:
+    case WAIT_FOR_PPP:
+    case WAIT_FOR_PPP_READ_DATA:
+    case WAIT_FOR_ACK:
+    case WAIT_FOR_STX:
+    case WAIT_FOR_STX2:
+    case MODE_E_WAIT_ACK:
+    case MODE_E_WAIT_UA:
+    case MODE_E_WAIT_AARE:
+    case MODE_E_WAIT_DATA:
+      // request still being transmitted, then the meter has up to tr to respond
+      if (connection_timeout_ms_ > 0) {
+        return connection_timeout_ms_;
+      }
+      return chars_time_ms_(last_tx_size_) + REACTION_TIME_MAX_MS + chars_time_ms_(1);
 
-  // Start with SOH, 'R', '1', STX
-  data_out_size_ = 0;
-  out_buf_[data_out_size_++] = SOH;
-  out_buf_[data_out_size_++] = 'R';
-  out_buf_[data_out_size_++] = '1';
-  out_buf_[data_out_size_++] = STX;
+    case READOUT:
+    case READOUT2:
+    case MODE_D_READOUT:
+      // characters of a message follow each other within ta
+      if (connection_timeout_ms_ > 0) {
+        return connection_timeout_ms_;
+      }
+      return INTER_CHAR_TIMEOUT_MS + chars_time_ms_(1);
 
-  // Copy OBIS code characters
-  size_t obis_len = strlen(obis_code);
-  for (size_t i = 0; i < obis_len; ++i) {
-    out_buf_[data_out_size_++] = obis_code[i];
+    default:
+      // not waiting for the meter
+      return UINT32_MAX;
   }
+}
 
-  // Add '(' and ')'
-  out_buf_[data_out_size_++] = '(';
-  out_buf_[data_out_size_++] = ')';
+void IEC62056Component::set_next_state_(CommState new_state) {
+  state_ = new_state;
+  state_timestamp_ = millis();
+  state_deadline_ms_ = state_timeout_ms_(new_state);
+}
 
-  // Add ETX
-  out_buf_[data_out_size_++] = ETX;
+void IEC62056Component::loop() {
+  publish_profile_row_();
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    process_records_();
+    return;
+  }
+#endif
+  process_state_machine_();
+}
 
-  // Calculate BCC (Block Check Character)
-  uint8_t bcc = 0x00;
-  for (size_t i = 1; i < data_out_size_; ++i) {
-    bcc ^= out_buf_[i];
+#ifdef USE_ESP32
+void IEC62056Component::protocol_task_fn_(void *arg) {
+  IEC62056Component *self = static_cast<IEC62056Component *>(arg);
+  while (true) {
+    const size_t rx_chunk_pos = self->rx_chunk_pos_;
+    const size_t rx_bytes = self->session_rx_bytes_;
+    self->process_state_machine_();
+    // a frame was consumed, the next one may be buffered already
+    if (self->rx_chunk_pos_ != rx_chunk_pos || self->session_rx_bytes_ != rx_bytes)
+      continue;
+    self->iuart_->wait_for_data(pdMS_TO_TICKS(PROTOCOL_TASK_IDLE_MS));
   }
-  // Append BCC
-  out_buf_[data_out_size_++] = bcc;
 }
 
+void IEC62056Component::push_record_(const ReadoutRecord &record) {
+  while (!records_.push(record)) {
+    vTaskDelay(1);  // main loop has not run since the queue filled up, wait
+  }
+}
 
-void IEC62056Component::update_baudrate_(uint32_t baudrate) {
-  ESP_LOGV(TAG, "Baudrate set to: %u bps", baudrate);
-  iuart_->update_baudrate(baudrate);
+void IEC62056Component::process_records_() {
+  ReadoutRecord record;
+  if (publishing_) {
+    // one sensor per loop(), records of the next readout wait in deferred_records_,
+    // so the protocol task is never blocked while it receives
+    while (records_.pop(record)) {
+      deferred_records_.push_back(record);
+    }
+    publishing_ = publish_next_sensor_();
+    return;
+  }
+
+  size_t processed = 0;
+  while (!publishing_ && processed < deferred_records_.size()) {
+    process_record_(deferred_records_[processed++]);
+  }
+  deferred_records_.erase(deferred_records_.begin(), deferred_records_.begin() + processed);
+
+  while (!publishing_ && records_.pop(record)) {
+    process_record_(record);
+  }
 }
 
-void IEC62056Component::loop() {
+void IEC62056Component::process_record_(const ReadoutRecord &record) {
+  switch (record.type) {
+    case ReadoutRecord::VALUE:
+      apply_sensor_value_(record.sensor, TextSpan(record.value, strlen(record.value)), record.numeric);
+      break;
+
+    case ReadoutRecord::CONNECTION:
+#ifdef USE_BINARY_SENSOR
+      if (readout_status_sensor_) {
+        readout_status_sensor_->publish_state(record.connected);
+      }
+#endif
+      break;
+
+    case ReadoutRecord::DISCARD:
+      reset_all_sensors_();
+      break;
+
+    case ReadoutRecord::SAVE_BAUD_RATE: {
+      uint32_t bps;
+      memcpy(&bps, record.value, sizeof(bps));
+      baud_rate_pref_.save(&bps);
+      break;
+    }
+
+    case ReadoutRecord::SAVE_METER_CACHE: {
+      MeterCache cache;
+      memcpy(&cache, record.value, sizeof(cache));
+      meter_cache_pref_.save(&cache);
+      break;
+    }
+
+    case ReadoutRecord::RESET_PROFILE_CURSOR:
+      reset_published_profile_cursor_();
+      break;
+
+    case ReadoutRecord::READOUT_END:
+      // sensors were verified by protocol task
+      ESP_LOGD(TAG, "Start of sensor update");
+      sensors_iterator_ = sensors_.begin();
+      publishing_ = true;
+      break;
+  }
+}
+#endif
+
+void IEC62056Component::finish_readout_() {
+  commit_value_hashes_();
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    // registers_ belong to this task, the main loop gets only the values
+    verify_all_sensors_got_value_();
+    ReadoutRecord record;
+    record.type = ReadoutRecord::READOUT_END;
+    push_record_(record);
+    wait_next_readout_();
+    return;
+  }
+#endif
+  verify_all_sensors_got_value_();
+  ESP_LOGD(TAG, "Start of sensor update");
+  set_next_state_(UPDATE_STATES);
+  sensors_iterator_ = sensors_.begin();
+}
+
+void IEC62056Component::discard_readout_() {
+  ESP_LOGW(TAG, "Telegram discarded, sensors are not updated");
+  telegram_crc_pending_ = false;
+  for (auto &h : value_hashes_) {
+    h.seen = false;
+  }
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    ReadoutRecord record;
+    record.type = ReadoutRecord::DISCARD;
+    push_record_(record);
+    return;
+  }
+#endif
+  reset_all_sensors_();
+}
+
+bool IEC62056Component::verify_telegram_crc_(size_t frame_size) {
+  // !XXXX\r\n
+  bool valid = frame_size >= 7 && !telegram_crc_pending_;
+  uint16_t received = 0;
+  for (size_t i = 1; valid && i <= 4; i++) {
+    char c = in_buf_[i];
+    valid = isxdigit(c);
+    received = (received << 4) | (isdigit(c) ? c - '0' : toupper(c) - 'A' + 10);
+  }
+  if (!valid) {
+    ESP_LOGE(TAG, "Telegram without CRC");
+    return false;
+  }
+  if (received != telegram_crc_) {
+    ESP_LOGE(TAG, "Telegram CRC verification failed. Expected 0x%04X, got 0x%04X", telegram_crc_, received);
+    return false;
+  }
+  ESP_LOGD(TAG, "Telegram CRC verification is OK");
+  return true;
+}
+
+bool IEC62056Component::publish_next_sensor_() {
+  if (sensors_iterator_ == sensors_.end()) {
+    ESP_LOGD(TAG, "End of sensor update");
+    return false;
+  }
+
+  IEC62056SensorBase *s = (*sensors_iterator_).second;
+  sensors_iterator_++;
+  if (s->has_value()) {
+    s->publish();
+    s->reset();  // publish only values received in the next session
+  }
+  return true;
+}
+
+void IEC62056Component::process_state_machine_() {
   static char baud_rate_char;
-  static bool mode_d_empty_frame_received;
   static uint32_t new_baudrate;
 
-  const uint8_t id_request[5] = {'/', '?', '!', '\r', '\n'};
-  const uint8_t set_baud_and_programm[6] = {ACK, 0x30, 0x30, 0x31, 0x0d, 0x0a};
-  // const uint8_t set_baud[6] = {ACK, 0x30, 0x30, 0x30, 0x0d, 0x0a};
-  const uint8_t set_password[16] = {SOH, 'P', '1', STX, '(', '0', '0', '0', '0', '0', '0', '0', '0', ')', ETX, 0x61};
-  const uint8_t readout_energy[16] = {SOH, 'R', '1', STX, '0', 'F', '0', '8', '8', '0', 'F', 'F', '(', ')', ETX, 0x15};
   const uint32_t now = millis();
 
   size_t frame_size;
 
-  if (!is_wait_state_() && now - last_transmission_from_meter_timestamp_ >= connection_timeout_ms_) {
-    ESP_LOGE(TAG, "No transmission from meter.");
+  if (readout_requested_.exchange(false)) {
+    if (!is_wait_state_()) {
+      ESP_LOGD(TAG, "Readout in progress. Ignoring trigger.");
+    } else {
+      read_all_registers_ = true;
+      set_next_state_(BEGIN);
+    }
+  }
+
+  // time since the state was entered or since the last byte, whichever is later
+  uint32_t silence_ms = std::min(now - state_timestamp_, now - last_rx_timestamp_);
+  if (!is_wait_state_() && silence_ms >= state_deadline_ms_) {
+    ESP_LOGE(TAG, "No transmission from meter in %s for %u ms.", state2txt_(state_), silence_ms);
+    if (state_ == WAIT_FOR_PPP) {
+      ESP_LOGD(TAG, "No password request. The retry reads registers right away.");
+      password_required_ = false;
+    }
     connection_status_(false);
     retry_or_sleep_();
     return;
@@ -403,15 +728,24 @@ void IEC62056Component::loop() {
     case INFINITE_WAIT:
       // only switch can set another state
       report_state_();
-      update_last_transmission_from_meter_timestamp_();
       break;
 
     case WAIT:
       report_state_();
       if (check_wait_period_()) {
-        state_ = wait_next_state_;
+        set_next_state_(wait_next_state_);
+      }
+      break;
+
+    case WAIT_TX_DONE:
+      report_state_();
+      if (iuart_->is_tx_done()) {
+        ESP_LOGV(TAG, "TX done after %u ms", millis() - wait_start_timestamp_);
+        set_next_state_(wait_next_state_);
+      } else if (check_wait_period_()) {
+        ESP_LOGW(TAG, "TX not done after %u ms. Continuing.", wait_period_ms_);
+        set_next_state_(wait_next_state_);
       }
-      update_last_transmission_from_meter_timestamp_();
       break;
 
     case MODE_D_WAIT:
@@ -421,67 +755,102 @@ void IEC62056Component::loop() {
         char *packet = get_id_(frame_size);
         if (packet) {
           parse_id_(packet);
+          if (mode_d_crc_) {
+            // the CRC covers the identification line including \r\n
+            telegram_crc_ = 0;
+            for (const char *c = packet; *c; c++) {
+              telegram_crc_ = crc16_arc_update(telegram_crc_, *c);
+            }
+            telegram_crc_ = crc16_arc_update(crc16_arc_update(telegram_crc_, '\r'), '\n');
+            telegram_crc_pending_ = true;
+          }
           set_next_state_(MODE_D_READOUT);
-          update_last_transmission_from_meter_timestamp_();
+          reset_tokenizer_();
           retry_connection_start_timestamp_ = millis();
           connection_status_(true);
-          mode_d_empty_frame_received = false;
         }
       }
       break;
 
-    case MODE_D_READOUT:
+    case MODE_D_READOUT: {
       report_state_();
 
-      if ((frame_size = receive_frame_())) {
+      // the meter pushes the whole telegram at once, all buffered lines are handled
+      // in one call, otherwise the driver buffer overflows at 115200 bps
+      const uint32_t max_while_ms = 15;
+      uint32_t while_start = millis();
+      while (state_ == MODE_D_READOUT && (frame_size = receive_frame_())) {
         if (in_buf_[0] == '!') {
           connection_status_(false);
 
           // end of data
           ESP_LOGD(TAG, "Total connection time: %u ms", millis() - retry_connection_start_timestamp_);
 
-          verify_all_sensors_got_value_();
-          ESP_LOGD(TAG, "Start of sensor update");
-          set_next_state_(UPDATE_STATES);
-          sensors_iterator_ = sensors_.begin();
+          if (mode_d_crc_ && !verify_telegram_crc_(frame_size)) {
+            discard_readout_();
+            wait_next_readout_();
+          } else {
+            finish_readout_();
+          }
         } else {
-          // parse data frame
+          // data frame was parsed while received
+          // in mode D an empty line is sent after identification packet
           in_buf_[frame_size - 2] = 0;
-
           ESP_LOGD(TAG, "Data: '%s'", in_buf_);
+        }
 
-          // in mode D an empty line is sent after identification packet
-          // ignore only one
-          if (!mode_d_empty_frame_received && '\0' == in_buf_[0]) {
-            ESP_LOGV(TAG, "Ignore empty frame");
-            mode_d_empty_frame_received = true;
-            break;
-          }
-
-          std::string obis;
-          std::string val1;
-          std::string val2;
-
-          if (!parse_line_((const char *) in_buf_, obis, val1, val2)) {
-            ESP_LOGE(TAG, "Invalid frame format: '%s'", in_buf_);
-            break;
-          }
-
-          // Update all matching sensors
-          auto range = sensors_.equal_range(obis);
-          for (auto it = range.first; it != range.second; ++it) {
-            set_sensor_value_(it, val1.c_str(), val2.c_str());
-          }
+        // Make sure loop() is <30 ms. Protocol task is not limited by loop() time.
+        if (!protocol_task_ && millis() - while_start > max_while_ms) {
+          break;
         }
       }
       break;
+    }
 
     case BEGIN:
       report_state_();
+      if (!iuart_->is_tx_done() && now - state_timestamp_ < chars_time_ms_(last_tx_size_) + TX_DONE_MARGIN_MS) {
+        break;  // break command of the previous session is still sent at its baud rate
+      }
+      if (hdlc_format_) {
+        // DISC or the last frame of a failed session is sent, back to the format of mode C
+        iuart_->set_hdlc_format(false);
+        hdlc_format_ = false;
+      }
       current_obis_index_ = 0;  // Reset index at the beginning
+      if (!scheduled_timestamp_set_) {
+        if (profile_session_ && data_readout_) {
+          // data readout is done, the load profile is read with R5 in programming mode
+          ESP_LOGD(TAG, "Reading load profile after data readout");
+          data_readout_ = false;
+          for (auto &r : registers_) {
+            r.pending = r.pending && r.frame == nullptr;
+          }
+        } else {
+          profile_session_ = false;
+          select_readout_strategy_();
+          // retries read only registers not read yet
+          select_due_registers_();
+        }
+      }
 
       update_connection_start_timestamp_();
       connection_status_(true);
+      session_rx_bytes_ = 0;
+      baud_rate_error_ = false;
+      // only sessions with their own handshake count for baud rate stats
+      baud_rate_switched_ = false;
+
+      if (session_open_) {
+        // meter is still in programming mode, no handshake
+        if (!seek_pending_register_()) {
+          ESP_LOGD(TAG, "Keep-alive read");
+          current_obis_index_ = keep_alive_register_();
+          registers_[current_obis_index_].pending = true;
+        }
+        set_next_state_(ASK_FOR_ENERGY);
+        break;
+      }
 
       if (battery_meter_) {
         set_next_state_(BATTERY_WAKEUP);
@@ -489,8 +858,6 @@ void IEC62056Component::loop() {
         set_next_state_(SEND_REQUEST);
       }
       update_baudrate_(300);  // make sure we start with 300 bps
-
-      update_last_transmission_from_meter_timestamp_();
       break;
 
     case BATTERY_WAKEUP:
@@ -499,13 +866,13 @@ void IEC62056Component::loop() {
       // 2. wait 1.5-1.7
       // 3. send standard identification message
 
-      // if we send 84 NULLs at 300 baud it will take ~2.24s
+      // 84 NULLs at 300 baud take ~2.8s, see chars_time_ms_()
       report_state_();
 
       ESP_LOGD(TAG, "Battery meter wakeup sequence");
 
       this->send_battery_wakeup_sequence_();
-      wait_(1600 + 2240, SEND_REQUEST);  // wait for ~1.6s + 2.24s for all NULLs transmitted
+      wait_(1600 + chars_time_ms_(last_tx_size_), SEND_REQUEST);  // wait for ~1.6s + all NULLs transmitted
       break;
 
     case SEND_REQUEST:
@@ -513,10 +880,7 @@ void IEC62056Component::loop() {
 
       clear_uart_input_buffer_();  // remove garbage including NULLs from battery meter wakeup sequence
 
-      static_assert(MAX_OUT_BUF_SIZE >= sizeof(id_request), "Out buffer too small");
-      memcpy(out_buf_, id_request, sizeof(id_request));
-      data_out_size_ = sizeof(id_request);
-      send_frame_();
+      send_frame_(ID_REQUEST, sizeof(ID_REQUEST));
       set_next_state_(GET_IDENTIFICATION);
       break;
 
@@ -527,6 +891,11 @@ void IEC62056Component::loop() {
         char *packet = get_id_(frame_size);
         if (packet) {
           parse_id_(packet);
+          if (meter_cache_valid_ && meter_identification_ != meter_cache_.identification) {
+            ESP_LOGW(TAG, "Meter identification changed from '%s'. Rediscovering parameters.",
+                     meter_cache_.identification);
+            forget_meter_();
+          }
         } else {
           ESP_LOGE(TAG, "Invalid identification frame");
           retry_or_sleep_();
@@ -548,6 +917,10 @@ void IEC62056Component::loop() {
       if (mode_ == PROTOCOL_MODE_A) {
         ESP_LOGVV(TAG, "Using PROTOCOL_MODE_A");
         // switching baud rate not supported, start reading data
+        if (readout_mode_ == READOUT_MODE_AUTO && registers_readout_ms_ == 0) {
+          registers_readout_ms_ = UINT32_MAX;  // no programming mode in protocol A
+        }
+        data_readout_ = true;
         set_next_state_(WAIT_FOR_STX);
         break;
       }
@@ -571,34 +944,88 @@ void IEC62056Component::loop() {
         baud_rate_char = baud_rate_identification_;
       }
 
-      // if (retry_counter_ > 0) {  // decrease baud rate for retry
-      //   baud_rate_char -= retry_counter_;
-      //   if (mode_ == PROTOCOL_MODE_B && baud_rate_char < PROTO_B_RANGE_BEGIN) {
-      //     baud_rate_char = PROTO_B_RANGE_BEGIN;
-      //   } else if (baud_rate_char < PROTO_C_RANGE_BEGIN) {
-      //     baud_rate_char = PROTO_C_RANGE_BEGIN;
-      //   }
-      //   ESP_LOGD(TAG, "Decreased baud rate for retry %u to: %d bps ('%c').", retry_counter_,
-      //            identification_to_baud_rate_(baud_rate_char), baud_rate_char);
-      // }
-
-      data_out_size_ = sizeof(set_baud_and_programm);
-      memcpy(out_buf_, set_baud_and_programm, data_out_size_);
-      out_buf_[2] = baud_rate_char;
-      send_frame_();
+      // rate learned from failures in previous sessions
+      session_baud_rate_bps_ = identification_to_baud_rate_(baud_rate_char);
+      baud_rate_limited_ = learned_baud_rate_bps_ != 0 && learned_baud_rate_bps_ < session_baud_rate_bps_;
+      if (baud_rate_limited_) {
+        session_baud_rate_bps_ = learned_baud_rate_bps_;
+        baud_rate_char = baud_rate_to_identification_(session_baud_rate_bps_);
+        ESP_LOGD(TAG, "Using learned baud rate %u bps ('%c').", session_baud_rate_bps_, baud_rate_char);
+      }
+
+      static_assert(sizeof(ack_buf_) == sizeof(OPTION_SELECT), "ACK buffer size");
+      memcpy(ack_buf_, OPTION_SELECT, sizeof(OPTION_SELECT));
+      ack_buf_[2] = baud_rate_char;
+      hdlc_session_ = mode_e_enabled_ && mode_e_offered_;
+      if (hdlc_session_) {
+        // binary mode HDLC, registers are read with DLMS GET
+        data_readout_ = false;
+        ack_buf_[1] = '2';
+        ack_buf_[3] = '2';
+      } else {
+        ack_buf_[3] = data_readout_ ? '0' : '1';
+      }
+      send_frame_(ack_buf_, sizeof(ack_buf_));
+      programming_session_ = !data_readout_ && !hdlc_session_;
+      mode_e_echo_checked_ = false;
+      mode_e_ack_ = false;
 
       new_baudrate = identification_to_baud_rate_(baud_rate_char);
 
       // wait for the frame to be fully transmitted before changing baud rate,
       // otherwise port get stuck and no packet can be received (ESP32)
+      wait_tx_done_(hdlc_session_ ? MODE_E_WAIT_ACK : SET_BAUD_RATE);
+      break;
 
-      wait_(250, SET_BAUD_RATE);
+    case MODE_E_WAIT_ACK:
+      report_state_();
+      if (!mode_e_echo_checked_) {
+        // option select is sent, its echo is already buffered, while the meter
+        // answers the same 6 characters at 300 bps not earlier than 20 ms later
+        mode_e_echo_checked_ = true;
+        mode_e_echo_ = this->available() + (rx_chunk_size_ - rx_chunk_pos_) >= sizeof(ack_buf_);
+      }
+      // the meter confirms option select at the old baud rate: ACK 2 Z 2 CR LF
+      if ((frame_size = receive_frame_())) {
+        if (in_buf_[frame_size - 1] == ACK) {
+          mode_e_ack_ = true;  // frame ends at ACK, "2Z2" CR LF follows
+          break;
+        }
+        bool ack = mode_e_ack_ && frame_size == sizeof(ack_buf_) - 1 && 0 == memcmp(in_buf_, ack_buf_ + 1, frame_size);
+        mode_e_ack_ = false;
+        if (!ack) {
+          ESP_LOGV(TAG, "Not an acknowledgement of option select");
+          break;
+        }
+        if (mode_e_echo_) {
+          ESP_LOGVV(TAG, "Echo. Ignore frame.");
+          mode_e_echo_ = false;
+          break;
+        }
+        set_next_state_(SET_BAUD_RATE);
+      }
       break;
 
     case SET_BAUD_RATE:
       ESP_LOGD(TAG, "Switching to new baud rate %u bps ('%c')", new_baudrate, baud_rate_char);
       update_baudrate_(new_baudrate);
-      set_next_state_(WAIT_FOR_PPP);
+      baud_rate_switched_ = true;
+      if (hdlc_session_) {
+        // IEC 62056-46 frames are 8N1, mode C uses 7E1
+        iuart_->set_hdlc_format(true);
+        hdlc_format_ = true;
+      }
+      // data readout begins right after the baud rate change
+      if (hdlc_session_) {
+        set_next_state_(MODE_E_CONNECT);
+      } else if (data_readout_) {
+        set_next_state_(WAIT_FOR_STX);
+      } else if (password_required_) {
+        set_next_state_(WAIT_FOR_PPP);
+      } else {
+        session_open_ = keep_session_ && keep_alive_register_() < registers_.size();
+        set_next_state_(ASK_FOR_ENERGY);
+      }
       break;
 
     case WAIT_FOR_PPP:
@@ -606,6 +1033,7 @@ void IEC62056Component::loop() {
       if (receive_frame_() >= 1) {
         if (SOH == in_buf_[0]) {  // RX: 01.50.30.02 (4) |.P0.|
           ESP_LOGD(TAG, "Meter asks for password");
+          password_required_ = true;
           set_next_state_(WAIT_FOR_PPP_READ_DATA);
         } else {
           ESP_LOGD(TAG, "No PPP. Got 0x%02x", in_buf_[0]);
@@ -629,9 +1057,7 @@ void IEC62056Component::loop() {
 
     case SEND_PASSWORD:
        report_state_();
-       data_out_size_ = sizeof(set_password);
-       memcpy(out_buf_, set_password, data_out_size_);
-       send_frame_();
+       send_frame_(SET_PASSWORD, sizeof(SET_PASSWORD));
        set_next_state_(WAIT_FOR_ACK);
     break;
 
@@ -642,6 +1068,8 @@ void IEC62056Component::loop() {
       if (receive_frame_() >= 1) {
         if (ACK == in_buf_[0]) {
           ESP_LOGD(TAG, "Meter accepted password");
+          // without R1 registers there is nothing to keep the session alive with
+          session_open_ = keep_session_ && keep_alive_register_() < registers_.size();
           set_next_state_(ASK_FOR_ENERGY);
         } else {
           ESP_LOGD(TAG, "Meter rejected password. Got 0x%02x", in_buf_[0]);
@@ -674,8 +1102,22 @@ void IEC62056Component::loop() {
 
     case ASK_FOR_ENERGY:
       report_state_();
-      build_readout_command_(obis_codes_[current_obis_index_]);  // Build command for current OBIS code
-      send_frame_();
+      if (!seek_pending_register_()) {
+        ESP_LOGD(TAG, "No more registers to read");
+        if (!session_open_) {
+          send_break_();
+        }
+        connection_status_(false);
+        session_succeeded_();
+        finish_readout_();
+        break;
+      }
+      if (registers_[current_obis_index_].frame == nullptr) {
+        send_profile_request_();
+      } else {
+        // precomputed by codegen
+        send_frame_(registers_[current_obis_index_].frame, registers_[current_obis_index_].frame_size);
+      }
       set_next_state_(WAIT_FOR_STX);
       break;
 
@@ -688,8 +1130,13 @@ void IEC62056Component::loop() {
         if (STX == in_buf_[0]) {
           ESP_LOGD(TAG, "Meter started readout transmission");
           set_next_state_(READOUT);
+          reset_tokenizer_();
         } else {
           ESP_LOGD(TAG, "No STX. Got 0x%02x", in_buf_[0]);
+          if (SOH == in_buf_[0] && !password_required_) {
+            ESP_LOGD(TAG, "Meter asks for password after all");
+            password_required_ = true;
+          }
           retry_or_sleep_();
         }
       }
@@ -705,154 +1152,381 @@ void IEC62056Component::loop() {
           ESP_LOGD(TAG, "Detected ETX at the end of data");
           ESP_LOGD(TAG, "Total connection time: %u ms", millis() - retry_connection_start_timestamp_);
 
-          // Reset lrc_
-          lrc_ = 0x00;
-          // Update lrc_ over data bytes including ETX, exclude BCC
-          update_lrc_(in_buf_, frame_size - 1);  // Exclude BCC byte
+          // lrc_ was updated over data bytes including ETX while received
 
-          // Verify BCC
-          bool bcc_failed = false;
+          // Verify BCC, the last block is repeated like a partial one
           if (lrc_ == readout_lrc_) {
             ESP_LOGD(TAG, "BCC verification is OK");
+          } else if (block_repeats_ < BLOCK_REPEAT_MAX) {
+            ESP_LOGW(TAG, "BCC verification failed. Expected 0x%02x, got 0x%02x. Ask to repeat", lrc_, readout_lrc_);
+            block_repeats_++;
+            baud_rate_error_ = true;
+            restore_block_state_();
+            send_frame_(NAK_BLOCK, sizeof(NAK_BLOCK));
+            break;
           } else {
-            ESP_LOGE(TAG, "BCC verification failed. Expected 0x%02x, got 0x%02x", lrc_, readout_lrc_);
-            bcc_failed = true;
+            ESP_LOGE(TAG, "BCC verification failed %u times", (unsigned) block_repeats_ + 1);
+            baud_rate_error_ = true;
+            retry_or_sleep_();
+            break;
           }
 
-          // Process the data before proceeding
+          // The data was parsed while received
+          commit_block_values_();
           in_buf_[frame_size - 2] = 0;  // Null-terminate before ETX
           ESP_LOGD(TAG, "Data: %s", in_buf_);
-          std::string obis;
-          std::string val1;
-          std::string val2;
-
-          if (!parse_line_((const char *) in_buf_, obis, val1, val2)) {
-            ESP_LOGE(TAG, "Invalid frame format: '%s'", in_buf_);
-          } else {
-            // Update all matching sensors
-            auto range = sensors_.equal_range(obis);
-            for (auto it = range.first; it != range.second; ++it) {
-              set_sensor_value_(it, val1.c_str(), val2.c_str());
-            }
-          }
 
           connection_status_(false);
 
-          if (bcc_failed) {
-            ESP_LOGD(TAG, "BCC check has failed, but will carry on with the sensors update for now...");
-            // Handle BCC failure if necessary
+          if (data_readout_) {
+            // all lines received in one transmission
+            session_succeeded_();
+            // load profile is not part of data readout, it is read in the next session
+            profile_session_ = mode_ != PROTOCOL_MODE_A &&
+                               std::any_of(registers_.begin(), registers_.end(),
+                                           [](const RequestRegister &r) { return r.pending && r.frame == nullptr; });
+            finish_readout_();
+            break;
+          }
+
+          if (profile_readout_) {
+            finish_profile_readout_();
           }
 
-          // Move to the next OBIS code or proceed to updating sensors
-          if (++current_obis_index_ < num_obis_codes_) {
-            // There are more OBIS codes to read
-            set_next_state_(ASK_FOR_ENERGY);
+          // Move to the next OBIS code, updating sensors begins when all are read
+          if (current_obis_index_ < registers_.size()) {
+            registers_[current_obis_index_++].pending = false;
+          }
+          set_next_state_(ASK_FOR_ENERGY);
+        } else if (frame_size >= 2 && in_buf_[frame_size - 2] == EOT) {
+          // partial block, its lines were parsed while received
+          if (lrc_ == readout_lrc_) {
+            ESP_LOGD(TAG, "Partial block received, ask for the next one");
+            block_repeats_ = 0;
+            commit_block_values_();
+            save_block_state_();
+            send_frame_(ACK_BLOCK, sizeof(ACK_BLOCK));
+          } else if (block_repeats_ < BLOCK_REPEAT_MAX) {
+            ESP_LOGW(TAG, "Partial block BCC failed. Expected 0x%02x, got 0x%02x. Ask to repeat", lrc_, readout_lrc_);
+            block_repeats_++;
+            baud_rate_error_ = true;
+            restore_block_state_();
+            send_frame_(NAK_BLOCK, sizeof(NAK_BLOCK));
           } else {
-            // All OBIS codes have been read
-            verify_all_sensors_got_value_();
-            ESP_LOGD(TAG, "Start of sensor update");
-            set_next_state_(UPDATE_STATES);
-            sensors_iterator_ = sensors_.begin();
+            ESP_LOGE(TAG, "Partial block BCC failed %u times", (unsigned) block_repeats_ + 1);
+            baud_rate_error_ = true;
+            retry_or_sleep_();
           }
-        } else {
+        } else if (frame_size >= 2 && in_buf_[frame_size - 1] == '\n') {
           // Handle data frames without ETX (if applicable)
-          update_lrc_(in_buf_, frame_size);
-
           in_buf_[frame_size - 2] = 0;  // Null-terminate the data string
           ESP_LOGD(TAG, "Data: %s", in_buf_);
-          std::string obis;
-          std::string val1;
-          std::string val2;
-
-          if (!parse_line_((const char *) in_buf_, obis, val1, val2)) {
-            ESP_LOGE(TAG, "Invalid frame format: '%s'", in_buf_);
-            break;
-          }
-
-          // Update all matching sensors
-          auto range = sensors_.equal_range(obis);
-          for (auto it = range.first; it != range.second; ++it) {
-            set_sensor_value_(it, val1.c_str(), val2.c_str());
-          }
         }
       }
       break;
 
-    case UPDATE_STATES:
+    case MODE_E_CONNECT:
       report_state_();
-      if (sensors_iterator_ != sensors_.end()) {
-        IEC62056SensorBase *s = (*sensors_iterator_).second;
-        sensors_iterator_++;
-        if (s->has_value()) {
-          s->publish();
+      hdlc_.reset();
+      send_frame_(hdlc_tx_, hdlc_.build_control(hdlc_tx_, HDLC_SNRM));
+      set_next_state_(MODE_E_WAIT_UA);
+      break;
+
+    case MODE_E_WAIT_UA:
+      report_state_();
+      if (receive_hdlc_() == HDLC_CONTROL) {
+        if (hdlc_.control() != HDLC_UA) {
+          ESP_LOGE(TAG, "Meter refused HDLC connection. Control 0x%02x", hdlc_.control());
+          retry_or_sleep_();
+          break;
         }
-      } else {
-        ESP_LOGD(TAG, "End of sensor update");
+        ESP_LOGD(TAG, "HDLC connected");
+        send_apdu_(DLMS_AARQ, sizeof(DLMS_AARQ));
+        set_next_state_(MODE_E_WAIT_AARE);
+      }
+      break;
 
-        wait_next_readout_();  // wait for the next cycle
+    case MODE_E_WAIT_AARE:
+      report_state_();
+      if (receive_hdlc_() == HDLC_APDU) {
+        if (!dlms_aare_accepted(hdlc_.apdu(), hdlc_.apdu_size())) {
+          ESP_LOGE(TAG, "Meter rejected association of public client");
+          retry_or_sleep_();
+          break;
+        }
+        ESP_LOGD(TAG, "Association accepted");
+        set_next_state_(MODE_E_ASK);
+      }
+      break;
+
+    case MODE_E_ASK: {
+      report_state_();
+      if (!seek_pending_register_()) {
+        ESP_LOGD(TAG, "No more registers to read");
+        send_break_();
+        connection_status_(false);
+        session_succeeded_();
+        finish_readout_();
         break;
       }
-  }
-}
+      RequestRegister &r = registers_[current_obis_index_];
+      if (r.frame == nullptr) {
+        ESP_LOGW(TAG, "Register '%s' can't be read in mode E", r.obis.c_str());
+        r.pending = false;
+        break;
+      }
+      uint8_t ln[6];
+      r.code.to_logical_name(ln);
+      // scaler is read once, objects without it are read as Data
+      dlms_attribute_ = r.dlms_class == 0 ? DLMS_ATTRIBUTE_SCALER_UNIT : DLMS_ATTRIBUTE_VALUE;
+      uint8_t request[DLMS_GET_REQUEST_SIZE];
+      dlms_get_request(request, r.dlms_class == 0 ? DLMS_CLASS_REGISTER : r.dlms_class, ln, dlms_attribute_);
+      send_apdu_(request, sizeof(request));
+      set_next_state_(MODE_E_WAIT_DATA);
+      break;
+    }
+
+    case MODE_E_WAIT_DATA:
+      report_state_();
+      if (receive_hdlc_() == HDLC_APDU) {
+        process_get_response_();
+        set_next_state_(MODE_E_ASK);
+      }
+      break;
 
-void IEC62056Component::update_lrc_(const uint8_t *data, size_t size) {
-  for (size_t i = 0; i < size; i++) {
-    lrc_ ^= data[i];
+    case UPDATE_STATES:
+      report_state_();
+      if (!publish_next_sensor_()) {
+        wait_next_readout_();  // wait for the next cycle
+      }
+      break;
   }
 }
 
 float IEC62056Component::get_setup_priority() const { return setup_priority::DATA; }
 
+/// @brief Orders @ref SENSOR_MAP items by C.D.E*F.
+struct SensorObisLess {
+  bool operator()(const SENSOR_MAP::value_type &item, const ObisCode &obis) const { return item.first.cdef < obis.cdef; }
+  bool operator()(const ObisCode &obis, const SENSOR_MAP::value_type &item) const { return obis.cdef < item.first.cdef; }
+};
+
 void IEC62056Component::register_sensor(IEC62056SensorBase *sensor) {
-  this->sensors_.insert({sensor->get_obis(), sensor});
+  ObisCode code;
+  if (!ObisCode::parse(sensor->get_obis(), code)) {
+    ESP_LOGE(TAG, "Invalid OBIS code '%s'", sensor->get_obis().c_str());
+    return;
+  }
+  // keep sorted, sensors with the same OBIS in registration order
+  auto pos = std::upper_bound(sensors_.begin(), sensors_.end(), code, SensorObisLess());
+  this->sensors_.insert(pos, {code, sensor});
+  obis_filter_.add(code);
 }
 
-bool IEC62056Component::validate_float_(const char *value) {
-  // safe value, in reality this number is related to the number of digits on meter's display
-  const size_t max_len = 20;
-  size_t count = 0;
-  const char *p = value;
-  while (*p && *p != '*') {  // ignore unit at the end
-    if (!(isdigit(*p) || *p == '.' || *p == '-')) {
-      return false;
+std::pair<SENSOR_MAP::iterator, SENSOR_MAP::iterator> IEC62056Component::find_sensors_(const ObisCode &obis) {
+  return std::equal_range(sensors_.begin(), sensors_.end(), obis, SensorObisLess());
+}
+
+void IEC62056Component::reset_tokenizer_() {
+  tokenizer_.reset();
+  line_sensors_ = std::make_pair(sensors_.end(), sensors_.end());
+  block_repeats_ = 0;
+  drop_block_values_();
+  save_block_state_();
+}
+
+void IEC62056Component::save_block_state_() {
+  block_tokenizer_ = tokenizer_;
+  block_line_sensors_ = line_sensors_;
+  block_line_obis_ = line_obis_;
+  block_profile_parser_ = profile_parser_;
+  block_profile_overflow_ = profile_overflow_;
+}
+
+void IEC62056Component::restore_block_state_() {
+  // values of the failed block are received again when the block is repeated
+  drop_block_values_();
+  tokenizer_ = block_tokenizer_;
+  line_sensors_ = block_line_sensors_;
+  line_obis_ = block_line_obis_;
+  profile_parser_ = block_profile_parser_;
+  profile_overflow_ = block_profile_overflow_;
+}
+
+void IEC62056Component::commit_block_values_() {
+  for (auto &v : block_values_) {
+    store_sensor_value_(v.sensor, TextSpan(v.value, v.size), v.numeric);
+  }
+  block_values_.clear();
+
+  for (const auto &row : block_rows_) {
+    if (!profile_rows_.push(row)) {
+      // the cursor stays at the last row in the buffer, the rest is read in the next session
+      ESP_LOGW(TAG, "Load profile buffer full after %u rows", (unsigned) profile_rows_read_);
+      profile_overflow_ = true;
+      break;
     }
-    p++;
-    count++;
+    memcpy(profile_cursor_.timestamp, row.text, PROFILE_TIMESTAMP_LEN);  // row begins with its timestamp
+    profile_rows_read_++;
   }
+  block_rows_.clear();
+}
 
-  return count > 0 && count <= max_len;
+void IEC62056Component::drop_block_values_() {
+  block_values_.clear();
+  block_rows_.clear();
 }
 
-bool IEC62056Component::set_sensor_value_(SENSOR_MAP::iterator &i, const char *value1, const char *value2) {
-  const char *value = value1;
-  IEC62056SensorBase *sensor = i->second;
-  SensorType type = sensor->get_type();
-  if (type == TEXT_SENSOR) {
-    IEC62056TextSensor *txt = static_cast<IEC62056TextSensor *>(sensor);
-    switch (txt->get_group()) {
-      case 0:  // set entire frame
-        value = (const char *) this->in_buf_;
-        break;
+void IEC62056Component::process_token_(TokenEvent event) {
+  if (profile_readout_) {
+    process_profile_token_(event);
+    return;
+  }
 
-      case 2:
-        value = value2;
+  switch (event) {
+    case TOKEN_OBIS:
+      line_sensors_ = std::make_pair(sensors_.end(), sensors_.end());
+      // one lookup per line, used by all groups; most lines of a readout are rejected by the filter
+      if (ObisCode::parse(tokenizer_.obis(), line_obis_) && obis_filter_.may_contain(line_obis_)) {
+        line_sensors_ = find_sensors_(line_obis_);
+      }
+      if (line_sensors_.first == line_sensors_.second) {
+        // no sensor for this code, values are not parsed
+        tokenizer_.skip_line();
         break;
+      }
+      if (data_readout_) {
+        // data readout delivers registers in any order
+        for (auto &r : registers_) {
+          if (line_obis_.matches(r.code)) {
+            r.pending = false;
+          }
+        }
+      }
+      break;
+
+    case TOKEN_GROUP: {
+      const DataGroup &group = tokenizer_.group();
+      for (auto it = line_sensors_.first; it != line_sensors_.second; ++it) {
+        if (sensor_group_(it->second) == group.index && it->first.matches(line_obis_)) {
+          update_sensor_value_(it, group.value, group.numeric);
+        }
+      }
+      break;
+    }
+
+    case TOKEN_ERROR:
+      ESP_LOGE(TAG, "Invalid data line format");
+      line_sensors_ = std::make_pair(sensors_.end(), sensors_.end());
+      break;
+
+    default:
+      break;
+  }
+}
 
-        // defaults to value1
+void IEC62056Component::update_line_sensors_(const TextSpan &line) {
+  for (auto it = line_sensors_.first; it != line_sensors_.second; ++it) {
+    if (sensor_group_(it->second) == 0 && it->first.matches(line_obis_)) {
+      update_sensor_value_(it, line, false);
     }
-    txt->set_value(value);
+  }
+  line_sensors_ = std::make_pair(sensors_.end(), sensors_.end());
+}
+
+uint8_t IEC62056Component::sensor_group_(IEC62056SensorBase *sensor) {
+  if (sensor->get_type() == TEXT_SENSOR) {
+    return static_cast<IEC62056TextSensor *>(sensor)->get_group();
+  }
+  return 1;  // number is always in the first group
+}
 
-    ESP_LOGD(TAG, "Set text sensor '%s' for OBIS '%s' group %d. Value: '%s'", txt->get_name().c_str(),
-             txt->get_obis().c_str(), txt->get_group(), value);
+bool IEC62056Component::set_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric) {
+  if (state_ == READOUT) {
+    // the block may be repeated, values are stored when its BCC is verified
+    block_values_.emplace_back();
+    BlockValue &v = block_values_.back();
+    v.sensor = i;
+    v.numeric = numeric;
+    v.size = std::min(value.size, sizeof(v.value));
+    memcpy(v.value, value.data, v.size);
+    return true;
+  }
+  return store_sensor_value_(i, value, numeric);
+}
+
+bool IEC62056Component::store_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric) {
+  IEC62056SensorBase *sensor = i->second;
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    values_received_[i - sensors_.begin()] = true;
+    ReadoutRecord record;
+    record.type = ReadoutRecord::VALUE;
+    record.sensor = sensor;
+    record.numeric = numeric;
+    size_t len = std::min(value.size, sizeof(record.value) - 1);
+    memcpy(record.value, value.data, len);
+    record.value[len] = '\0';
+    push_record_(record);
+    return true;
+  }
+#endif
+  return apply_sensor_value_(sensor, value, numeric);
+}
+
+bool IEC62056Component::update_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric) {
+  if (value_hashes_.empty()) {
+    return set_sensor_value_(i, value, numeric);
+  }
+  ValueHash &h = value_hashes_[i - sensors_.begin()];
+  h.received = value.hash();
+  h.seen = true;
+  if (h.committed_valid && h.committed == h.received) {
+    return false;
+  }
+  return set_sensor_value_(i, value, numeric);
+}
+
+void IEC62056Component::commit_value_hashes_() {
+  bool reported = false;
+  for (size_t i = 0; i < value_hashes_.size(); i++) {
+    ValueHash &h = value_hashes_[i];
+    if (h.seen) {
+      h.committed = h.received;
+      h.committed_valid = true;
+      h.seen = false;
+    } else if (!reported) {
+      ESP_LOGE(TAG, "Not all sensors received data from the meter. The first one: OBIS '%s'.",
+               sensors_[i].second->get_obis().c_str());
+      reported = true;
+    }
+  }
+}
+
+bool IEC62056Component::apply_sensor_value_(IEC62056SensorBase *sensor, const TextSpan &value, bool numeric) {
+  SensorType type = sensor->get_type();
+  if (type == TEXT_SENSOR) {
+    IEC62056TextSensor *txt = static_cast<IEC62056TextSensor *>(sensor);
+    txt->set_value(value.data, value.size);
+
+    ESP_LOGD(TAG, "Set text sensor '%s' for OBIS '%s' group %d. Value: '%.*s'", txt->get_name().c_str(),
+             txt->get_obis().c_str(), txt->get_group(), (int) value.size, value.data);
   } else {  // SENSOR
     // convert to float
-    if (validate_float_(value)) {
+    if (numeric) {
+      // copy to stack, value is not null terminated
+      char buf[MAX_FLOAT_LEN + 1];
+      size_t len = std::min(value.size, MAX_FLOAT_LEN);
+      memcpy(buf, value.data, len);
+      buf[len] = '\0';
+
       IEC62056Sensor *sen = static_cast<IEC62056Sensor *>(sensor);
-      float f = strtof(value, nullptr);
+      float f = strtof(buf, nullptr);
       sen->set_value(f);
       ESP_LOGD(TAG, "Set sensor '%s' for OBIS '%s'. Value: %f", sen->get_name().c_str(), sen->get_obis().c_str(), f);
     } else {
-      ESP_LOGE(TAG, "Cannot convert data to number. Consider using text sensor. Invalid data: '%s'", value);
+      ESP_LOGE(TAG, "Cannot convert data to number. Consider using text sensor. Invalid data: '%.*s'",
+               (int) value.size, value.data);
       return false;
     }
   }
@@ -868,9 +1542,27 @@ void IEC62056Component::reset_all_sensors_() {
 }
 
 void IEC62056Component::verify_all_sensors_got_value_() {
-  for (const auto &item : sensors_) {
+  if (!value_hashes_.empty()) {
+    return;  // unchanged values are not set, see commit_value_hashes_()
+  }
+  for (size_t i = 0; i < sensors_.size(); i++) {
+    const auto &item = sensors_[i];
     IEC62056SensorBase *s = item.second;
-    if (!s->has_value()) {
+    if (!force_mode_d_) {
+      // only registers read in the last session are expected
+      auto r = std::find_if(registers_.begin(), registers_.end(),
+                            [&item](const RequestRegister &r) { return r.code.matches(item.first); });
+      if (r == registers_.end() || !r->due) {
+        continue;
+      }
+    }
+    bool got_value = s->has_value();
+#ifdef USE_ESP32
+    if (protocol_task_) {
+      got_value = values_received_[i];  // sensors are updated by the main loop
+    }
+#endif
+    if (!got_value) {
       ESP_LOGE(TAG,
                "Not all sensors received data from the meter. The first one: OBIS '%s'. Verify sensor is defined with "
                "valid OBIS code.",
@@ -878,74 +1570,11 @@ void IEC62056Component::verify_all_sensors_got_value_() {
       break;  // Display just one error. If more displayed, component could take a long time for an operation
     }
   }
+#ifdef USE_ESP32
+  values_received_.assign(values_received_.size(), false);
+#endif
 }
 
-// Valid OBIS codes may be empty or may contain digits and uppercase letters
-bool IEC62056Component::validate_obis_(const std::string &obis) {
-  const size_t max_obis_len = 25;  // Arbitrary chosen max length
-
-  // Allow empty OBIS codes
-  if (obis.empty()) {
-    ESP_LOGVV(TAG, "OBIS code is empty");
-    return true;
-  }
-
-  // Check if the OBIS code exceeds the maximum allowed length
-  if (obis.size() > max_obis_len) {
-    ESP_LOGVV(TAG, "OBIS code is too long");
-    return false;
-  }
-
-  // Validate each character in the OBIS code
-  for (const char &c : obis) {
-    if (!(c == ':' || c == '.' || c == '-' || c == '*' ||
-          (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z'))) {
-      ESP_LOGVV(TAG, "OBIS code has invalid characters");
-      return false;
-    }
-  }
-  return true;
-}
-
-bool IEC62056Component::parse_line_(const char *line, std::string &out_obis, std::string &out_value1,
-                                    std::string &out_value2) {
-  const char *open_bracket = nullptr;
-  const char *close_bracket = nullptr;
-  const char *open_bracket2 = nullptr;
-  const char *close_bracket2 = nullptr;
-
-  const char *p = line;
-  while (*p) {
-    if ('(' == *p && !open_bracket) {
-      open_bracket = p;
-    } else if (')' == *p && !close_bracket) {
-      close_bracket = p;
-    } else if ('(' == *p && !open_bracket2) {
-      open_bracket2 = p;
-    } else if (')' == *p && !close_bracket2) {
-      close_bracket2 = p;
-    }
-    p++;  // Increment pointer after processing the character
-  }
-
-  if (!open_bracket || !close_bracket || close_bracket < open_bracket) {
-    ESP_LOGVV(TAG, "Missing expected open and closing bracket");
-    return false;
-  }
-
-  out_obis.assign(line, open_bracket - line);
-  out_value1.assign(open_bracket + 1, close_bracket - open_bracket - 1);
-
-  if (open_bracket2 && close_bracket2 && close_bracket2 > open_bracket2) {
-    out_value2.assign(open_bracket2 + 1, close_bracket2 - open_bracket2 - 1);
-  } else {
-    out_value2.erase();
-  }
-
-  return validate_obis_(out_obis);
-}
-
-
 void IEC62056Component::clear_uart_input_buffer_() {
   int available = this->available();
   int len;
@@ -960,7 +1589,8 @@ void IEC62056Component::clear_uart_input_buffer_() {
     this->read_array(in_buf_, len);
     available -= len;
   }
-  data_in_size_ = 0;
+  frame_.reset();
+  rx_chunk_pos_ = rx_chunk_size_ = 0;
 }
 
 void IEC62056Component::wait_(uint32_t ms, CommState state) {
@@ -971,6 +1601,14 @@ void IEC62056Component::wait_(uint32_t ms, CommState state) {
   wait_next_state_ = state;
 }
 
+void IEC62056Component::wait_tx_done_(CommState state) {
+  ESP_LOGVV(TAG, "Start WAIT_TX_DONE");
+  set_next_state_(WAIT_TX_DONE);
+  wait_start_timestamp_ = millis();
+  wait_period_ms_ = chars_time_ms_(last_tx_size_) + TX_DONE_MARGIN_MS;
+  wait_next_state_ = state;
+}
+
 const char *IEC62056Component::state2txt_(CommState state) {
   switch (state) {
     case BATTERY_WAKEUP:
@@ -982,6 +1620,9 @@ const char *IEC62056Component::state2txt_(CommState state) {
     case WAIT:
       return "WAIT";
 
+    case WAIT_TX_DONE:
+      return "WAIT_TX_DONE";
+
     case SEND_REQUEST:
       return "SEND_REQUEST";
 
@@ -1030,6 +1671,24 @@ const char *IEC62056Component::state2txt_(CommState state) {
     case WAIT_FOR_PPP_READ_DATA:
       return "WAIT_FOR_PPP_READ_DATA";
 
+    case MODE_E_WAIT_ACK:
+      return "MODE_E_WAIT_ACK";
+
+    case MODE_E_CONNECT:
+      return "MODE_E_CONNECT";
+
+    case MODE_E_WAIT_UA:
+      return "MODE_E_WAIT_UA";
+
+    case MODE_E_WAIT_AARE:
+      return "MODE_E_WAIT_AARE";
+
+    case MODE_E_ASK:
+      return "MODE_E_ASK";
+
+    case MODE_E_WAIT_DATA:
+      return "MODE_E_WAIT_DATA";
+
     default:
       return "UNKNOWN";
   }
@@ -1043,7 +1702,39 @@ void IEC62056Component::report_state_() {
 }
 
 void IEC62056Component::retry_or_sleep_() {
+  // values of a block without verified BCC are never stored
+  drop_block_values_();
+  if (profile_readout_) {
+    // rows already in the buffer are published, the cursor follows them
+    finish_profile_readout_();
+  }
+  // the meter may still be in programming mode, the next sign-on would collide with it
+  send_break_();
+
+  if (baud_rate_switched_) {
+    baud_rate_error_ = true;
+    update_baud_rate_stats_();
+    baud_rate_switched_ = false;
+  }
+
+  if (session_open_) {
+    ESP_LOGD(TAG, "Session lost. The next readout begins with handshake.");
+    session_open_ = false;
+  }
+
+  if (readout_mode_ == READOUT_MODE_AUTO && retry_counter_ >= max_retries_) {
+    // strategy that does not work is never chosen
+    uint32_t &time_ms = data_readout_ ? data_readout_ms_ : registers_readout_ms_;
+    if (time_ms == 0) {
+      ESP_LOGW(TAG, "Auto readout mode: %s readout failed", data_readout_ ? "data" : "registers");
+      time_ms = UINT32_MAX;
+    }
+  }
+
   if (force_mode_d_) {
+    if (mode_d_crc_) {
+      discard_readout_();  // incomplete telegram
+    }
     set_next_state_(MODE_D_WAIT);
   } else if (retry_counter_ >= max_retries_) {
     ESP_LOGD(TAG, "Exceeded retry counter.");
@@ -1061,13 +1752,9 @@ void IEC62056Component::trigger_readout() {
     return;
   }
 
-  if (!is_wait_state_()) {
-    ESP_LOGD(TAG, "Readout in progress. Ignoring trigger.");
-    return;
-  }
-
+  // handled by state machine, it may run in protocol task
   ESP_LOGD(TAG, "Triggering readout");
-  set_next_state_(BEGIN);
+  readout_requested_ = true;
 }
 
 void IEC62056Component::wait_next_readout_() {
@@ -1076,19 +1763,21 @@ void IEC62056Component::wait_next_readout_() {
     return;
   }
 
-  uint32_t now = millis();
-  uint32_t delta = now - scheduled_connection_start_timestamp_;
-  uint32_t actual_wait_time = update_interval_ms_ - delta;
+  // load profile follows data readout at once
+  uint32_t actual_wait_time = profile_session_ && data_readout_ ? 0 : time_to_next_readout_();
+  if (session_open_ && actual_wait_time > keep_alive_interval_ms_) {
+    // read a register before the meter leaves programming mode
+    actual_wait_time = keep_alive_interval_ms_;
+  }
 
   retry_counter_reset_();
-  if (delta > update_interval_ms_ && is_periodic_readout_enabled_()) {
-    ESP_LOGD(TAG, "Total connection time greater than configured update interval. Working continuously.");
-    actual_wait_time = 0;  // continuously read data
+  if (actual_wait_time == 0) {
+    ESP_LOGD(TAG, "Total connection time greater than update interval. Working continuously.");
   }
 
   scheduled_timestamp_set_ = false;
-  if (is_periodic_readout_enabled_()) {
-    ESP_LOGD(TAG, "Waiting %u ms for the next scheduled readout (every %u ms).", actual_wait_time, update_interval_ms_);
+  if (actual_wait_time != UINT32_MAX) {
+    ESP_LOGD(TAG, "Waiting %u ms for the next scheduled readout.", actual_wait_time);
     wait_(actual_wait_time, BEGIN);
   } else {
     // UINT32_MAX means no update, use switch to trigger readout
@@ -1098,6 +1787,398 @@ void IEC62056Component::wait_next_readout_() {
   }
 }
 
+void IEC62056Component::select_readout_strategy_() {
+  switch (readout_mode_) {
+    case READOUT_MODE_DATA:
+      data_readout_ = true;
+      break;
+
+    case READOUT_MODE_REGISTERS:
+      data_readout_ = false;
+      break;
+
+    case READOUT_MODE_AUTO:
+      // try each strategy once, then use the faster one
+      if (data_readout_ms_ == 0) {
+        data_readout_ = true;
+      } else if (registers_readout_ms_ == 0) {
+        data_readout_ = false;
+        read_all_registers_ = true;  // the same registers as in data readout
+      } else {
+        data_readout_ = data_readout_ms_ <= registers_readout_ms_;
+      }
+      break;
+  }
+
+  if (data_readout_) {
+    // the meter sends all registers and leaves the readout mode,
+    // keep_session is allowed only with registers readout
+    read_all_registers_ = true;
+  }
+}
+
+void IEC62056Component::update_readout_time_() {
+  uint32_t elapsed = millis() - retry_connection_start_timestamp_;
+  ESP_LOGD(TAG, "%s readout: %u ms, %u bytes", data_readout_ ? "Data" : "Registers", elapsed,
+           (unsigned) session_rx_bytes_);
+
+  // load profile is never in data readout, it is read in a session of its own
+  bool complete = std::none_of(registers_.begin(), registers_.end(),
+                               [](const RequestRegister &r) { return r.pending && r.frame != nullptr; });
+  if (data_readout_ && !complete) {
+    ESP_LOGW(TAG, "Data readout does not contain all registers. Use registers readout mode.");
+  }
+
+  if (readout_mode_ != READOUT_MODE_AUTO || profile_session_) {
+    return;  // load profile session is not a registers readout
+  }
+  uint32_t &time_ms = data_readout_ ? data_readout_ms_ : registers_readout_ms_;
+  if (time_ms != 0) {
+    return;  // already measured
+  }
+  time_ms = complete ? std::max<uint32_t>(elapsed, 1) : UINT32_MAX;
+  if (data_readout_ms_ != 0 && registers_readout_ms_ != 0) {
+    ESP_LOGI(TAG, "Auto readout mode: using %s readout", data_readout_ms_ <= registers_readout_ms_ ? "data" : "registers");
+  }
+}
+
+void IEC62056Component::send_break_() {
+  if (hdlc_session_) {
+    ESP_LOGD(TAG, "Sending HDLC disconnect");
+    send_frame_(hdlc_tx_, hdlc_.build_control(hdlc_tx_, HDLC_DISC));
+    hdlc_session_ = false;
+    return;
+  }
+  if (!programming_session_) {
+    return;
+  }
+  ESP_LOGD(TAG, "Sending break command");
+  send_frame_(BREAK_COMMAND, sizeof(BREAK_COMMAND));
+  programming_session_ = false;
+}
+
+HdlcEvent IEC62056Component::receive_hdlc_() {
+  const uint32_t max_while_ms = 15;
+  uint32_t while_start = millis();
+  while (true) {
+    if (rx_chunk_pos_ == rx_chunk_size_) {
+      rx_chunk_pos_ = 0;
+      rx_chunk_size_ = iuart_->read_available(rx_chunk_, RX_CHUNK_SIZE);
+      if (rx_chunk_size_ == 0) {
+        return HDLC_NONE;
+      }
+      last_rx_timestamp_ = millis();
+      session_rx_bytes_ += rx_chunk_size_;
+    }
+
+    // Make sure loop() is <30 ms. Protocol task is not limited by loop() time.
+    if (!protocol_task_ && millis() - while_start > max_while_ms) {
+      return HDLC_NONE;
+    }
+
+    HdlcEvent event = hdlc_.push(rx_chunk_[rx_chunk_pos_++]);
+    switch (event) {
+      case HDLC_NONE:
+        break;
+
+      case HDLC_ERROR:
+        // the meter repeats the frame after timeout
+        ESP_LOGW(TAG, "Invalid HDLC frame");
+        baud_rate_error_ = true;
+        break;
+
+      case HDLC_SEGMENT:
+        ESP_LOGV(TAG, "Segment received, %u bytes so far", (unsigned) hdlc_.apdu_size());
+        send_frame_(hdlc_tx_, hdlc_.build_rr(hdlc_tx_));
+        break;
+
+      default:
+        ESP_LOGVV(TAG, "RX: %s", format_hex_pretty(hdlc_.apdu(), hdlc_.apdu_size()).c_str());
+        return event;
+    }
+  }
+}
+
+void IEC62056Component::send_apdu_(const uint8_t *apdu, size_t size) {
+  send_frame_(hdlc_tx_, hdlc_.build_info(hdlc_tx_, apdu, size));
+}
+
+void IEC62056Component::process_get_response_() {
+  RequestRegister &r = registers_[current_obis_index_];
+  size_t size = 0;
+  const uint8_t *data = dlms_get_response_data(hdlc_.apdu(), hdlc_.apdu_size(), size);
+
+  if (dlms_attribute_ == DLMS_ATTRIBUTE_SCALER_UNIT) {
+    if (data && dlms_decode_scaler(data, size, r.scaler)) {
+      r.dlms_class = DLMS_CLASS_REGISTER;
+    } else {
+      r.dlms_class = DLMS_CLASS_DATA;
+      r.scaler = 0;
+    }
+    ESP_LOGD(TAG, "Register '%s': class %u, scaler %d", r.obis.c_str(), r.dlms_class, r.scaler);
+    return;  // the value is read next
+  }
+
+  r.pending = false;
+  char text[DLMS_MAX_TEXT_LEN];
+  bool numeric = false;
+  size_t len = data ? dlms_format_value(data, size, r.scaler, text, sizeof(text), numeric) : 0;
+  if (len == 0) {
+    ESP_LOGE(TAG, "Register '%s' not read. Access denied or unsupported data type.", r.obis.c_str());
+    return;
+  }
+  ESP_LOGD(TAG, "Data: %s(%s)", r.obis.c_str(), text);
+  auto sensors = find_sensors_(r.code);
+  for (auto it = sensors.first; it != sensors.second; ++it) {
+    if (it->first.matches(r.code)) {
+      set_sensor_value_(it, TextSpan(text, len), numeric);
+    }
+  }
+}
+
+template<typename T>
+void IEC62056Component::save_preference_(ESPPreferenceObject &pref, ReadoutRecord::Type type, const T &data) {
+#ifdef USE_ESP32
+  if (protocol_task_) {
+    static_assert(sizeof(T) <= ReadoutRecord::MAX_VALUE_SIZE, "Preference does not fit in record");
+    ReadoutRecord record;
+    record.type = type;
+    memcpy(record.value, &data, sizeof(T));
+    push_record_(record);
+    return;
+  }
+#endif
+  pref.save(&data);
+}
+
+void IEC62056Component::session_succeeded_() {
+  update_readout_time_();
+  update_baud_rate_stats_();
+  save_meter_cache_();
+}
+
+void IEC62056Component::save_meter_cache_() {
+  MeterCache cache{};
+  strncpy(cache.identification, meter_identification_.c_str(), sizeof(cache.identification) - 1);
+  cache.mode = mode_;
+  cache.baud_rate_identification = baud_rate_identification_;
+  cache.password_required = password_required_;
+  if (meter_cache_valid_ && 0 == memcmp(&cache, &meter_cache_, sizeof(cache))) {
+    return;  // no flash write
+  }
+  meter_cache_ = cache;
+  meter_cache_valid_ = true;
+  save_preference_(meter_cache_pref_, ReadoutRecord::SAVE_METER_CACHE, meter_cache_);
+  ESP_LOGD(TAG, "Meter parameters saved");
+}
+
+void IEC62056Component::forget_meter_() {
+  meter_cache_valid_ = false;
+  password_required_ = true;
+  if (learned_baud_rate_bps_ != 0) {
+    learned_baud_rate_bps_ = 0;
+    save_preference_(baud_rate_pref_, ReadoutRecord::SAVE_BAUD_RATE, learned_baud_rate_bps_);
+  }
+  baud_rate_probing_ = false;
+  baud_rate_clean_sessions_ = 0;
+  baud_rate_probe_sessions_ = BAUD_RATE_PROBE_SESSIONS;
+  data_readout_ms_ = 0;
+  registers_readout_ms_ = 0;
+  if (profile_sensor_ && profile_cursor_.timestamp[0] != 0) {
+    // timestamps of another meter
+    profile_cursor_ = {};
+#ifdef USE_ESP32
+    if (protocol_task_) {
+      ReadoutRecord record;
+      record.type = ReadoutRecord::RESET_PROFILE_CURSOR;
+      push_record_(record);
+      return;
+    }
+#endif
+    reset_published_profile_cursor_();
+  }
+}
+
+void IEC62056Component::send_profile_request_() {
+  // SOH R5 STX P.01(<from>;) ETX BCC, the row at <from> is returned again and skipped
+  size_t n = 0;
+  profile_request_[n++] = SOH;
+  profile_request_[n++] = 'R';
+  profile_request_[n++] = '5';
+  profile_request_[n++] = STX;
+  for (const char *p = "P.01("; *p; p++) {
+    profile_request_[n++] = *p;
+  }
+  for (const char *p = profile_cursor_.timestamp; *p; p++) {
+    profile_request_[n++] = *p;
+  }
+  profile_request_[n++] = ';';
+  profile_request_[n++] = ')';
+  profile_request_[n++] = ETX;
+  profile_request_[n] = frame_bcc(profile_request_ + 1, n - 1);
+  n++;
+
+  ESP_LOGD(TAG, "Reading load profile from '%s'", profile_cursor_.timestamp);
+  profile_parser_.reset();
+  profile_readout_ = true;
+  profile_overflow_ = false;
+  profile_rows_read_ = 0;
+  send_frame_(profile_request_, n);
+}
+
+void IEC62056Component::process_profile_token_(TokenEvent event) {
+  if (!profile_parser_.process(event, tokenizer_) || profile_overflow_) {
+    return;
+  }
+  if (profile_cursor_.timestamp[0] != 0 &&
+      memcmp(profile_parser_.timestamp(), profile_cursor_.timestamp, PROFILE_TIMESTAMP_LEN) <= 0) {
+    return;  // published in a previous session
+  }
+  // the queue holds PROFILE_QUEUE_SIZE - 1 rows
+  if (block_rows_.size() >= PROFILE_QUEUE_SIZE - 1) {
+    // more than fits in the buffer, the rest is read in the next session
+    profile_overflow_ = true;
+    return;
+  }
+  // queued for publishing when BCC of the block is verified, see commit_block_values_()
+  block_rows_.push_back(profile_parser_.row());
+}
+
+void IEC62056Component::finish_profile_readout_() {
+  profile_readout_ = false;
+  // the cursor is saved when the rows are published, see publish_profile_row_()
+  ESP_LOGD(TAG, "Load profile: %u new rows, the last '%s'", (unsigned) profile_rows_read_, profile_cursor_.timestamp);
+}
+
+void IEC62056Component::publish_profile_row_() {
+  ProfileRow row;
+  if (profile_sensor_ && profile_rows_.pop(row)) {
+    profile_sensor_->publish_state(row.text);
+    memcpy(published_profile_cursor_.timestamp, row.text, PROFILE_TIMESTAMP_LEN);  // row begins with its timestamp
+    profile_cursor_pref_.save(&published_profile_cursor_);
+  }
+}
+
+void IEC62056Component::reset_published_profile_cursor_() {
+  published_profile_cursor_ = {};
+  profile_cursor_pref_.save(&published_profile_cursor_);
+}
+
+void IEC62056Component::update_baud_rate_stats_() {
+  if (!baud_rate_switched_) {
+    return;
+  }
+
+  if (baud_rate_error_) {
+    if (baud_rate_probing_) {
+      // probe again, but less often
+      baud_rate_probe_sessions_ *= 2;
+      if (baud_rate_probe_sessions_ > BAUD_RATE_PROBE_SESSIONS_MAX) {
+        baud_rate_probe_sessions_ = BAUD_RATE_PROBE_SESSIONS_MAX;
+      }
+      baud_rate_probing_ = false;
+    }
+    baud_rate_clean_sessions_ = 0;
+
+    uint32_t lower = lower_baud_rate(session_baud_rate_bps_);
+    if (lower < (mode_ == PROTOCOL_MODE_B ? PROTO_B_MIN_BAUDRATE : BAUDRATES[0])) {
+      return;  // already the lowest
+    }
+    ESP_LOGW(TAG, "Errors at %u bps. Next session uses %u bps.", session_baud_rate_bps_, lower);
+    learned_baud_rate_bps_ = lower;
+    save_preference_(baud_rate_pref_, ReadoutRecord::SAVE_BAUD_RATE, learned_baud_rate_bps_);
+    return;
+  }
+
+  if (baud_rate_probing_) {
+    ESP_LOGI(TAG, "Baud rate %u bps works", session_baud_rate_bps_);
+    baud_rate_probing_ = false;
+    baud_rate_probe_sessions_ = BAUD_RATE_PROBE_SESSIONS;
+    save_preference_(baud_rate_pref_, ReadoutRecord::SAVE_BAUD_RATE, learned_baud_rate_bps_);
+  }
+
+  if (!baud_rate_limited_) {
+    return;  // the rate offered by the meter works
+  }
+  if (++baud_rate_clean_sessions_ >= baud_rate_probe_sessions_) {
+    baud_rate_clean_sessions_ = 0;
+    baud_rate_probing_ = true;
+    learned_baud_rate_bps_ = higher_baud_rate(session_baud_rate_bps_);
+    ESP_LOGD(TAG, "Trying %u bps in the next session", learned_baud_rate_bps_);
+  }
+}
+
+bool IEC62056Component::is_periodic_readout_enabled_() {
+  if (registers_.empty()) {
+    return UINT32_MAX != update_interval_ms_;
+  }
+  return std::any_of(registers_.begin(), registers_.end(),
+                     [](const RequestRegister &r) { return r.interval_ms != UINT32_MAX; });
+}
+
+void IEC62056Component::select_due_registers_() {
+  const uint32_t now = millis();
+  uint32_t shortest = UINT32_MAX;
+  for (const auto &r : registers_) {
+    shortest = std::min(shortest, r.interval_ms);
+  }
+  const uint32_t window = shortest / 2;
+
+  size_t count = 0;
+  for (auto &r : registers_) {
+    if (read_all_registers_ || !r.requested) {
+      r.due = read_all_registers_ || r.interval_ms != UINT32_MAX;
+    } else if (r.interval_ms == UINT32_MAX) {
+      r.due = false;
+    } else {
+      r.due = now - r.last_request_timestamp >= r.interval_ms - std::min(window, r.interval_ms);
+    }
+    r.pending = r.due;
+    if (r.due) {
+      r.requested = true;
+      r.last_request_timestamp = now;
+      count++;
+    }
+  }
+  read_all_registers_ = false;
+  ESP_LOGD(TAG, "%u of %u registers due", (unsigned) count, (unsigned) registers_.size());
+}
+
+bool IEC62056Component::seek_pending_register_() {
+  while (current_obis_index_ < registers_.size() && !registers_[current_obis_index_].pending) {
+    current_obis_index_++;
+  }
+  return current_obis_index_ < registers_.size();
+}
+
+size_t IEC62056Component::keep_alive_register_() {
+  // load profile has no R1 frame, its R5 request may return many rows
+  auto r = std::find_if(registers_.begin(), registers_.end(), [](const RequestRegister &r) { return r.frame != nullptr; });
+  return r - registers_.begin();
+}
+
+uint32_t IEC62056Component::time_to_next_readout_() {
+  const uint32_t now = millis();
+  if (registers_.empty()) {
+    if (!is_periodic_readout_enabled_()) {
+      return UINT32_MAX;
+    }
+    uint32_t delta = now - scheduled_connection_start_timestamp_;
+    return delta > update_interval_ms_ ? 0 : update_interval_ms_ - delta;
+  }
+
+  uint32_t wait = UINT32_MAX;
+  for (const auto &r : registers_) {
+    if (r.interval_ms == UINT32_MAX) {
+      continue;
+    }
+    uint32_t elapsed = now - r.last_request_timestamp;
+    uint32_t left = !r.requested || elapsed >= r.interval_ms ? 0 : r.interval_ms - elapsed;
+    wait = std::min(wait, left);
+  }
+  return wait;
+}
+
 void IEC62056Component::update_connection_start_timestamp_() {
   retry_connection_start_timestamp_ = millis();
 
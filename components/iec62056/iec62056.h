@@ -1,26 +1,45 @@
 #pragma once
 
 #include "esphome/core/component.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/uart/uart.h"
 #ifdef USE_BINARY_SENSOR
 #include "esphome/components/binary_sensor/binary_sensor.h"
 #endif
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+#include <atomic>
 #include <cstdint>
-#include <unordered_map>
+#include <vector>
 #include <string>
 #include <memory>
+#include <utility>
 #include "iec62056sensor.h"
 #include "iec62056uart.h"
+#include "iec62056frame.h"
+#include "iec62056queue.h"
+#include "iec62056parser.h"
+#include "iec62056obis.h"
+#include "iec62056profile.h"
+#include "iec62056hdlc.h"
+#include "iec62056dlms.h"
 
 namespace esphome {
 namespace iec62056 {
 
-using SENSOR_MAP = std::unordered_multimap<std::string, IEC62056SensorBase *>;
+/// @brief Sensors sorted by @ref ObisCode::cdef. Many sensors can use the same OBIS code.
+/// @remarks
+/// Sorted vector allows lookup by integer comparison. Sensors found by C.D.E*F
+/// must be checked with @ref ObisCode::matches().
+using SENSOR_MAP = std::vector<std::pair<ObisCode, IEC62056SensorBase *>>;
 
 /// @brief States for component state machine.
 enum CommState {
   BEGIN,
   WAIT,
+  WAIT_TX_DONE,
   SEND_REQUEST,
   GET_IDENTIFICATION,
   PREPARE_ACK,
@@ -39,6 +58,109 @@ enum CommState {
   BATTERY_WAKEUP,
   MODE_D_WAIT,
   MODE_D_READOUT,
+  MODE_E_WAIT_ACK,
+  MODE_E_CONNECT,
+  MODE_E_WAIT_UA,
+  MODE_E_WAIT_AARE,
+  MODE_E_ASK,
+  MODE_E_WAIT_DATA,
+};
+
+/// @brief Record passed from protocol task to the main loop.
+struct ReadoutRecord {
+  enum Type : uint8_t {
+    /// Value for @ref sensor
+    VALUE,
+    /// Connection status changed
+    CONNECTION,
+    /// All values received, publish sensors
+    READOUT_END,
+    /// Values received since the last @c READOUT_END are invalid
+    DISCARD,
+    /// Save learned baud rate from @ref value in preferences
+    SAVE_BAUD_RATE,
+    /// Save @ref MeterCache from @ref value in preferences
+    SAVE_METER_CACHE,
+    /// Meter changed, load profile starts from the beginning
+    RESET_PROFILE_CURSOR,
+  };
+  static const size_t MAX_VALUE_SIZE = 128;
+
+  Type type;
+  bool connected;
+  /// @ref value is a valid number
+  bool numeric;
+  IEC62056SensorBase *sensor;
+  char value[MAX_VALUE_SIZE];
+};
+
+/// @brief Mode D: hash of sensor value. Unchanged values are not converted nor published again.
+struct ValueHash {
+  /// Value in the last valid telegram
+  uint32_t committed{0};
+  bool committed_valid{false};
+  /// Value in the telegram being received
+  uint32_t received{0};
+  /// @ref received is valid
+  bool seen{false};
+};
+
+/// @brief Register read with R1 command.
+struct RequestRegister {
+  std::string obis;
+  /// Read period. @c UINT32_MAX means only switch can trigger reading.
+  uint32_t interval_ms;
+  /// Complete R1 request frame including BCC, generated at compile time
+  const uint8_t *frame;
+  size_t frame_size;
+  /// When the register was selected for a session the last time
+  uint32_t last_request_timestamp{0};
+  /// @ref last_request_timestamp is valid
+  bool requested{false};
+  /// Selected for the current session
+  bool due{false};
+  /// Selected for the current session and not read yet
+  bool pending{false};
+  /// Mode E: interface class, 0 until scaler is read
+  uint16_t dlms_class{0};
+  /// Mode E: integer values are multiplied by 10^scaler
+  int8_t scaler{0};
+  /// Normalized @ref obis
+  ObisCode code{};
+};
+
+/// @brief Value received in a partial block, stored when BCC of the block is verified.
+struct BlockValue {
+  SENSOR_MAP::iterator sensor;
+  /// @ref value is a valid number
+  bool numeric;
+  size_t size;
+  char value[ReadoutRecord::MAX_VALUE_SIZE];
+};
+
+/// @brief How values are read from the meter
+enum ReadoutMode {
+  /// Programming mode, R1 command for every register (option 1)
+  READOUT_MODE_REGISTERS,
+  /// Data readout, all registers in one transmission (option 0)
+  READOUT_MODE_DATA,
+  /// Try both, then use the faster one
+  READOUT_MODE_AUTO,
+};
+
+/// @brief Meter parameters saved in preferences. Readout starts without delay after boot.
+struct MeterCache {
+  /// Identification without leading '/', null terminated
+  char identification[32];
+  char mode;
+  char baud_rate_identification;
+  bool password_required;
+};
+
+/// @brief The last load profile row published, saved in preferences.
+struct ProfileCursor {
+  /// @c YYMMDDhhmm, empty if no row was read yet
+  char timestamp[PROFILE_TIMESTAMP_LEN + 1];
 };
 
 /// @brief Protocol types
@@ -69,17 +191,146 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   /// @brief Called when switch state changed. Begins readout.
   void trigger_readout();
   void set_mode_d(bool flag) { force_mode_d_ = flag; }
+  /// Mode D telegrams end with CRC16 after '!' (DSMR/P1). Sensors are updated
+  /// only from telegrams with valid CRC.
+  void set_mode_d_crc(bool flag) { mode_d_crc_ = flag; }
+  /// Use HDLC (IEC 62056-46) when the meter offers mode E.
+  /// @param flag @c false to read such meters in mode C
+  void set_mode_e(bool flag) { mode_e_enabled_ = flag; }
+  /// Run the protocol in a dedicated task (ESP32 only).
+  /// @param flag @c true to run state machine in a task, only publishing stays in @c loop()
+  void set_protocol_task(bool flag) { protocol_task_ = flag; }
+  void set_readout_mode(ReadoutMode mode) { readout_mode_ = mode; }
+  /// Text sensor publishing load profile (P.01) rows, one row per state.
+  /// The profile is read as a register with @c nullptr frame.
+  void set_load_profile_sensor(IEC62056TextSensor *sensor) { profile_sensor_ = sensor; }
+  /// Keep programming mode session open between readouts.
+  /// @param flag @c true to skip handshake until the session is lost
+  void set_keep_session(bool flag) { keep_session_ = flag; }
+  /// Maximum time without reading a register while the session is kept open.
+  /// Must be shorter than meter's inactivity timeout.
+  void set_keep_alive_interval(uint32_t val) { keep_alive_interval_ms_ = val; }
+  /// Adds OBIS code read with R1 command.
+  /// Codegen calls it once per code used by sensors.
+  /// @param interval_ms the shortest update interval of sensors using the code
+  /// @param frame R1 request frame with BCC, must be a static array
+  void add_request_obis(const std::string &obis, uint32_t interval_ms, const uint8_t *frame, size_t frame_size) {
+    RequestRegister r{obis, interval_ms, frame, frame_size};
+    ObisCode::parse(obis, r.code);
+    registers_.push_back(r);
+  }
 
  protected:
-  void build_readout_command_(const char *obis_code);
-  // Build the readout command for the given OBIS code
-  bool parse_line_(const char *line, std::string &out_obis, std::string &out_value1, std::string &out_value2);
+  /// Finds all sensors with C.D.E*F of @a obis. A-B is checked by the caller.
+  std::pair<SENSOR_MAP::iterator, SENSOR_MAP::iterator> find_sensors_(const ObisCode &obis);
+  /// Handles event from @ref tokenizer_. Sets values of sensors matching OBIS code.
+  void process_token_(TokenEvent event);
+  /// Sets text sensors using entire line (group 0).
+  /// @param line Data line without end of line characters. Only the last
+  /// @ref MAX_IN_BUF_SIZE bytes of longer lines.
+  void update_line_sensors_(const TextSpan &line);
+  /// Starts parsing data lines from the beginning.
+  void reset_tokenizer_();
+  /// @brief Remembers parser state at the end of a correct partial block.
+  void save_block_state_();
+  /// @brief Returns parser state to the end of the last correct block before the block is repeated.
+  /// Values of the failed block are dropped.
+  void restore_block_state_();
+  /// @brief Stores values and queues load profile rows of a block with verified BCC.
+  void commit_block_values_();
+  /// @brief Drops values of a block with BCC not verified yet.
+  void drop_block_values_();
+  /// @brief Check if state machine receives data lines
+  bool is_data_state_() { return state_ == READOUT || state_ == MODE_D_READOUT; }
   /// Reset values for all sensors.
   void reset_all_sensors_();
-  /// Sets sensor value. Detects sensor type. It does not publish the value.
+  /// Sets sensor value. In @c READOUT state the value waits in @ref block_values_
+  /// until BCC of the block is verified, otherwise see @ref store_sensor_value_().
   /// \retval true the value was changed
   /// \retval false the value was not changed. The value is not a number.
-  bool set_sensor_value_(SENSOR_MAP::iterator &i, const char *value1, const char *value2);
+  /// @param numeric @a value was validated as a number
+  bool set_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric);
+  /// Stores sensor value. Detects sensor type. It does not publish the value.
+  /// In protocol task mode the value is passed to the main loop.
+  bool store_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric);
+  /// Sets sensor value unless the same value was received in the last valid
+  /// mode D telegram. The sensor keeps the published value then.
+  /// @retval false value not changed
+  bool update_sensor_value_(SENSOR_MAP::iterator &i, const TextSpan &value, bool numeric);
+  /// Mode D: values of a valid telegram become the reference for the next one.
+  /// Reports sensors without value, unchanged values included.
+  void commit_value_hashes_();
+  /// Returns () group used by the sensor. 0 means entire line.
+  uint8_t sensor_group_(IEC62056SensorBase *sensor);
+  /// Converts and stores value in the sensor. Must be called from the main loop.
+  bool apply_sensor_value_(IEC62056SensorBase *sensor, const TextSpan &value, bool numeric);
+  /// Publishes the next sensor pointed by @ref sensors_iterator_.
+  /// @retval false all sensors published
+  bool publish_next_sensor_();
+  /// @brief Selects registers for a new session.
+  ///
+  /// A register is read when it is due within half of the shortest register interval,
+  /// so registers with different intervals share handshakes instead of each
+  /// starting a new session.
+  void select_due_registers_();
+  /// Moves @ref current_obis_index_ to the next pending register.
+  /// @retval false no more registers to read in this session
+  bool seek_pending_register_();
+  /// @brief The first register read with R1, used to keep the session alive.
+  /// @return Index in @ref registers_, its size if there is no such register
+  size_t keep_alive_register_();
+  /// @brief Time until the earliest register is due.
+  /// @return @c UINT32_MAX if no readout is scheduled
+  uint32_t time_to_next_readout_();
+  /// Chooses data readout or registers readout for a new session.
+  void select_readout_strategy_();
+  /// Logs duration of successful readout. In auto mode remembers it for
+  /// the strategy used, incomplete data readout is never chosen.
+  void update_readout_time_();
+  /// Requests load profile rows newer than @ref profile_cursor_ with R5 command.
+  void send_profile_request_();
+  /// Queues complete rows for publishing and moves the cursor.
+  void process_profile_token_(TokenEvent event);
+  /// Saves the cursor when it moved.
+  void finish_profile_readout_();
+  /// Publishes one queued row. Runs in @c loop().
+  void publish_profile_row_();
+  void reset_published_profile_cursor_();
+  /// Sends B0 if the meter is in programming mode, or DISC in mode E. It returns
+  /// to idle at once, so the next sign-on does not collide with a stale session.
+  void send_break_();
+  /// Reads bytes of HDLC frames in mode E. Asks for the next segment of
+  /// a segmented APDU. Never waits for data.
+  /// @return @c HDLC_CONTROL or @c HDLC_APDU when received, otherwise @c HDLC_NONE
+  HdlcEvent receive_hdlc_();
+  /// Sends DLMS APDU in I frame.
+  void send_apdu_(const uint8_t *apdu, size_t size);
+  /// Handles GET response for the current register. Sets sensors when value was read.
+  void process_get_response_();
+  /// @brief Saves @a data in @a pref. In protocol task mode @a data is copied
+  /// to a record of @a type and saved by the main loop, preferences are not thread-safe.
+  template<typename T> void save_preference_(ESPPreferenceObject &pref, ReadoutRecord::Type type, const T &data);
+  /// Updates statistics and saved parameters after successful readout.
+  void session_succeeded_();
+  /// Saves identification and negotiated parameters when they changed.
+  void save_meter_cache_();
+  /// Discards everything learned about the meter. Called when identification changes.
+  void forget_meter_();
+  /// @brief Adapts baud rate after a session at switched baud rate.
+  ///
+  /// Errors (BCC, timeout, unexpected frame) step the rate down for the next session.
+  /// After @ref baud_rate_probe_sessions_ clean sessions below the rate offered by
+  /// the meter the next higher rate is tried. The working rate is saved in preferences.
+  void update_baud_rate_stats_();
+  /// Ends readout and starts publishing sensors.
+  void finish_readout_();
+  /// Drops values received in this readout, nothing is published.
+  void discard_readout_();
+  /// Compares CRC after '!' in @ref in_buf_ with @ref telegram_crc_.
+  bool verify_telegram_crc_(size_t frame_size);
+  /// IEC 62056-21 state machine. Called from @c loop() or from protocol task.
+  void process_state_machine_();
+  /// Reports the first sensor without value. In protocol task mode it runs in the task.
   void verify_all_sensors_got_value_();
   void connection_status_(bool connected);
   /// Returns a pointer to null terminated string (without starting '/')
@@ -87,17 +338,29 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   /// @remarks
   /// The function can ignore garbage at the beginning of the packet before '/' character
   char *get_id_(size_t frame_size);
-  void update_last_transmission_from_meter_timestamp_() { last_transmission_from_meter_timestamp_ = millis(); }
   void parse_id_(const char *packet);
   /// @brief Sets protocol mode based on baud rate char
   /// @param z baud rate char from identification package
   void set_protocol_(char z);
   /// Dynamically sets UART baud rate
   void update_baudrate_(uint32_t baudrate);
-  /// Sends data stored in @a out_buf_
-  void send_frame_();
-  /// Reads data from serial port until the end of line \r\n or STX/ETX
+  /// Sends frame directly from @a data without copying.
+  /// @a data must stay valid until the echo is received, see @ref tx_frame_.
+  void send_frame_(const uint8_t *data, size_t size);
+  /// Time to transmit @a chars characters at the current baud rate, rounded up
+  uint32_t chars_time_ms_(size_t chars) const;
+  /// @brief Maximum time without a byte from the meter in @a state.
+  /// @return Configured @ref connection_timeout_ms_ or the time derived from the baud rate
+  /// and IEC 62056-21 reaction times. @c UINT32_MAX if the state does not wait for the meter.
+  uint32_t state_timeout_ms_(CommState state) const;
+  /// Reads data from serial port until the end of line \r\n or STX/ETX/EOT
   ///
+  /// Data is drained from UART driver in chunks (@ref rx_chunk_). Bytes after
+  /// the end of the frame are kept for the next call.
+  /// Frames longer than @ref MAX_IN_BUF_SIZE keep only the last bytes.
+  /// In data states lines of any length are parsed by @ref tokenizer_ and BCC is
+  /// computed while bytes arrive, so only the tail is needed in @ref in_buf_.
+  /// Never waits for data. Incomplete frame is discarded after @ref inter_char_timeout_ms_.
   /// @return 0 if no frame received or length of the frame when received
   size_t receive_frame_();
   /// Returns baud rate identification.
@@ -111,9 +374,11 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   void retry_counter_inc_() { retry_counter_++; }
   /// @brief Check if retry or wait for the next scheduled readout.
   void retry_or_sleep_();
-  void update_lrc_(const uint8_t *data, size_t size);
   void reset_lrc_() { lrc_ = 0; }
   void wait_(uint32_t ms, CommState state);
+  /// Waits until UART transmitted all data, then switches to @a state.
+  /// Gives up when the frame should have been sent long ago.
+  void wait_tx_done_(CommState state);
   void clear_uart_input_buffer_();
   void send_battery_wakeup_sequence_();
   /// Checks wait timeout
@@ -122,10 +387,8 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   bool check_wait_period_() { return millis() - wait_start_timestamp_ >= wait_period_ms_; }
   /// @brief Diagnostic function that reports the state.
   void report_state_();
-  void set_next_state_(CommState new_state) { state_ = new_state; }
-  /// @brief Not very strict format checker.
-  /// To detect transmission errors (LRC is not the best checksum).
-  bool validate_obis_(const std::string &obis);
+  /// Switches state and starts the timeout of the new state
+  void set_next_state_(CommState new_state);
   /// @brief Converts state enum to string.
   const char *state2txt_(CommState state);
   /// @brief Waits computed time to get precise updates as configured.
@@ -136,7 +399,7 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   /// @brief Check if periodic readout is enabled
   /// @retval true yes, read data from meter time to time
   /// @retval false only switch can trigger readout
-  bool is_periodic_readout_enabled_() { return UINT32_MAX != update_interval_ms_; }
+  bool is_periodic_readout_enabled_();
   /// @brief Check if state machine in in one of wait states
   /// @retval true in wait state
   /// @retval false not in wait state
@@ -147,7 +410,18 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   static const char PROTO_C_RANGE_BEGIN = '0';
   static const char PROTO_C_RANGE_END = '6';
   static const size_t MAX_IN_BUF_SIZE = 128;
-  static const size_t MAX_OUT_BUF_SIZE = 84;
+  static const size_t RX_CHUNK_SIZE = 64;
+  /// Start bit, 7 data bits, parity, stop bit
+  static const uint32_t BITS_PER_CHAR = 10;
+  /// Maximum time before the meter responds to a message (IEC 62056-21 tr)
+  static const uint32_t REACTION_TIME_MAX_MS = 1500;
+  /// Maximum time between two characters of a message (IEC 62056-21 ta)
+  static const uint32_t INTER_CHAR_TIMEOUT_MS = 1500;
+  /// Clean sessions before a higher baud rate is tried, doubled after each failed try
+  static const uint32_t BAUD_RATE_PROBE_SESSIONS = 16;
+  static const uint32_t BAUD_RATE_PROBE_SESSIONS_MAX = 256;
+  /// Added to the transmission time in @ref WAIT_TX_DONE before giving up
+  static const uint32_t TX_DONE_MARGIN_MS = 50;
 
   /// @brief A list of sensors.
   SENSOR_MAP sensors_;
@@ -160,8 +434,8 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   uint32_t update_interval_ms_;
   /// @brief Maximum baud rate from the config or 0 if not set
   uint32_t config_baud_rate_max_bps_;
-  /// @brief Configured connection timeout.
-  uint32_t connection_timeout_ms_;
+  /// @brief Configured connection timeout. 0 means derived from the baud rate for every state.
+  uint32_t connection_timeout_ms_{0};
   /// @brief Counts number of retries.
   int retry_counter_{0};
   /// @brief Maximum number of retires. Set from configuration file.
@@ -172,13 +446,31 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   bool battery_meter_;
   /// @brief The current state of the state machine.
   CommState state_;
-  /// @brief Timestamp, the last transmission from the meter.
-  uint32_t last_transmission_from_meter_timestamp_;
+  /// @brief Timestamp, when @ref state_ was entered.
+  uint32_t state_timestamp_{0};
+  /// @brief Timeout of @ref state_, see @ref state_timeout_ms_().
+  uint32_t state_deadline_ms_{UINT32_MAX};
+  /// @brief Baud rate the UART is currently set to.
+  uint32_t baud_rate_{300};
+  /// @brief The size of the last frame sent to the meter, see @ref tx_frame_.
+  size_t last_tx_size_{0};
   /// @brief I/O input buffer
-  /// @sa data_in_size_
+  /// @remarks
+  /// Storage of @ref frame_. Holds the complete frame after @ref receive_frame_() returns.
   uint8_t in_buf_[MAX_IN_BUF_SIZE];
-  /// The size of data in I/O input buffer
-  size_t data_in_size_;
+  /// @brief Assembles received bytes into frames using @ref in_buf_ as a ring buffer.
+  FrameAssembler frame_{in_buf_, MAX_IN_BUF_SIZE};
+  /// @brief Bytes drained from UART driver, not yet processed by @ref receive_frame_()
+  uint8_t rx_chunk_[RX_CHUNK_SIZE];
+  /// Number of bytes in @ref rx_chunk_
+  size_t rx_chunk_size_{0};
+  /// Index of the next byte to process in @ref rx_chunk_
+  size_t rx_chunk_pos_{0};
+  /// @brief Timestamp, the last time any byte was received.
+  uint32_t last_rx_timestamp_{0};
+  /// @brief Incomplete frame is discarded when no byte arrives within this time.
+  /// Updated with the baud rate.
+  uint32_t inter_char_timeout_ms_{INTER_CHAR_TIMEOUT_MS};
   /// Meter identification.
   /// @remark For future use to support not fully compliant meters
   std::string meter_identification_;
@@ -186,17 +478,17 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   ProtocolMode mode_;
   /// Baud rate as read from identification packet or 0 (not provided)
   char baud_rate_identification_;
-  /// @brief I/O output buffer
-  uint8_t out_buf_[MAX_OUT_BUF_SIZE];
-  /// The size of data in I/O output buffer
-  size_t data_out_size_;
-  /// @brief Computed LRC/BCC.
+  /// @brief The last frame sent. Used to detect the echo. @c nullptr when echo was received.
+  const uint8_t *tx_frame_{nullptr};
+  /// @brief Option select message with the negotiated baud rate.
+  uint8_t ack_buf_[6];
+  /// @brief Computed LRC/BCC. Updated by @ref receive_frame_() in data states.
   uint8_t lrc_;
   /// @brief BCC received from the meter.
   uint8_t readout_lrc_;
   /// @brief When WAIT state began.
   uint32_t wait_start_timestamp_;
-  /// @brief Time period in WAIT state.
+  /// @brief Time period in WAIT state. Timeout in WAIT_TX_DONE state.
   uint32_t wait_period_ms_;
   /// @brief What is the next state after WAIT
   CommState wait_next_state_;
@@ -210,22 +502,163 @@ class IEC62056Component : public Component, public uart::UARTDevice {
   /// @retval false @ref scheduled_connection_start_timestamp_ is not valid.
   /// @retval true  @ref scheduled_connection_start_timestamp_ was set.
   bool scheduled_timestamp_set_{false};
-  /// @brief Check if string is valid float value
-  bool validate_float_(const char *value);
+  /// @brief Splits data lines while they are received.
+  DataLineTokenizer tokenizer_;
+  /// @brief OBIS codes of all sensors, checked before lookup in @ref sensors_.
+  ObisFilter obis_filter_;
+  /// @brief Sensors matching OBIS code of the line being received.
+  std::pair<SENSOR_MAP::iterator, SENSOR_MAP::iterator> line_sensors_;
+  /// @brief OBIS code of the line being received
+  ObisCode line_obis_;
+  /// @brief Max number of NAKs for one partial block
+  static const uint8_t BLOCK_REPEAT_MAX = 3;
+  /// @brief Parser state at the end of the last correct partial block.
+  /// A line may continue in the next block, so the state is restored on NAK
+  /// instead of buffering the whole block.
+  DataLineTokenizer block_tokenizer_;
+  std::pair<SENSOR_MAP::iterator, SENSOR_MAP::iterator> block_line_sensors_;
+  ObisCode block_line_obis_;
+  LoadProfileParser block_profile_parser_;
+  bool block_profile_overflow_{false};
+  /// @brief Values of the block being received, see @ref commit_block_values_().
+  std::vector<BlockValue> block_values_;
+  /// @brief Load profile rows of the block being received.
+  std::vector<ProfileRow> block_rows_;
+  /// @brief NAKs sent for the current partial block
+  uint8_t block_repeats_{0};
+  /// @brief Mode D: one item per sensor in @ref sensors_, empty in other modes.
+  std::vector<ValueHash> value_hashes_;
   /// @brief Iterator used for publishing sensor values.
   SENSOR_MAP::iterator sensors_iterator_;
   /// @brief Custom extended serial port object.
   std::unique_ptr<IEC62056UART> iuart_;
   /// @brief Indicates unidirectional communication, mode D
   bool force_mode_d_;
+  /// @brief Mode D telegrams end with CRC16
+  bool mode_d_crc_{false};
+  /// @brief CRC of mode D telegram computed while received
+  uint16_t telegram_crc_{0};
+  /// @brief '!' not received yet, @ref telegram_crc_ is updated
+  bool telegram_crc_pending_{false};
+  /// @brief Use mode E when the meter offers it
+  bool mode_e_enabled_{false};
+  /// @brief Identification of the meter ends with @c \2
+  bool mode_e_offered_{false};
+  /// @brief The current session uses HDLC, no break command but DISC
+  bool hdlc_session_{false};
+  /// @brief UART is switched to 8N1 for HDLC, restored at the next @c BEGIN
+  bool hdlc_format_{false};
+  /// @brief Buffered bytes were checked for the echo of option select after TX done
+  bool mode_e_echo_checked_{false};
+  /// @brief The next acknowledgement of option select is its echo
+  bool mode_e_echo_{false};
+  /// @brief ACK received, the rest of acknowledgement of option select follows
+  bool mode_e_ack_{false};
+  HdlcLink hdlc_;
+  /// @brief The largest frame sent is AARQ
+  uint8_t hdlc_tx_[HdlcLink::max_frame_size(sizeof(DLMS_AARQ))];
+  /// @brief Attribute of the current register requested with GET
+  uint8_t dlms_attribute_{0};
+  /// @brief Run state machine in a dedicated task.
+  bool protocol_task_{false};
+  /// @brief Readout requested by the switch.
+  std::atomic<bool> readout_requested_{false};
+#ifdef USE_ESP32
+  static const uint32_t PROTOCOL_TASK_STACK_SIZE = 4096;
+  static const UBaseType_t PROTOCOL_TASK_PRIORITY = 5;
+  /// Longest sleep of the idle protocol task, UART events wake it earlier
+  static const uint32_t PROTOCOL_TASK_IDLE_MS = 10;
+  static const size_t RECORD_QUEUE_SIZE = 16;
 
+  static void protocol_task_fn_(void *arg);
+  /// Sends record to the main loop. Waits when the queue is full.
+  void push_record_(const ReadoutRecord &record);
+  /// Consumes records from protocol task and publishes sensors. Runs in @c loop().
+  /// The queue is emptied in every call, also while sensors are published.
+  void process_records_();
+  /// Handles one record from protocol task. Runs in @c loop().
+  void process_record_(const ReadoutRecord &record);
 
-private:
-  size_t current_obis_index_;
-  static const char *obis_codes_[];
-  static const size_t num_obis_codes_;
-
-
+  TaskHandle_t protocol_task_handle_{nullptr};
+  /// @brief Records from protocol task to the main loop.
+  SPSCQueue<ReadoutRecord, RECORD_QUEUE_SIZE> records_;
+  /// @brief Main loop is publishing sensors.
+  bool publishing_{false};
+  /// @brief Records received while publishing, processed when publishing ends.
+  std::vector<ReadoutRecord> deferred_records_;
+  /// @brief Protocol task: value was sent for the sensor with the same index in @ref sensors_.
+  std::vector<bool> values_received_;
+#endif
+  /// @brief OBIS codes requested with R1 command, no duplicates.
+  std::vector<RequestRegister> registers_;
+  /// @brief Index of the register being read in @ref registers_.
+  size_t current_obis_index_{0};
+  /// @brief The next session reads all registers regardless of their intervals.
+  bool read_all_registers_{false};
+  /// @brief Keep programming mode session open between readouts.
+  bool keep_session_{false};
+  /// @brief Time between readouts while the session is kept open.
+  uint32_t keep_alive_interval_ms_{30000};
+  /// @brief Meter is in programming mode, readout can begin without handshake.
+  bool session_open_{false};
+  /// @brief Option select for programming mode was sent and no break command since.
+  bool programming_session_{false};
+  /// @brief Configured readout strategy.
+  ReadoutMode readout_mode_{READOUT_MODE_REGISTERS};
+  /// @brief The current session uses data readout instead of R1 commands.
+  bool data_readout_{false};
+  /// @brief Load profile was not read in data readout. Set at its end, then the next
+  /// session reads only the load profile.
+  bool profile_session_{false};
+  /// @brief Auto mode: duration of data readout. 0 not measured yet, @c UINT32_MAX failed.
+  uint32_t data_readout_ms_{0};
+  /// @brief Auto mode: duration of registers readout. 0 not measured yet, @c UINT32_MAX failed.
+  uint32_t registers_readout_ms_{0};
+  /// @brief Bytes received since the session started.
+  size_t session_rx_bytes_{0};
+  /// @brief Highest baud rate that works with the meter. 0 if not limited.
+  uint32_t learned_baud_rate_bps_{0};
+  /// @brief Baud rate negotiated for the current session.
+  uint32_t session_baud_rate_bps_{0};
+  /// @brief @ref learned_baud_rate_bps_ is lower than the rate offered by the meter.
+  bool baud_rate_limited_{false};
+  /// @brief Baud rate was switched in the current session.
+  bool baud_rate_switched_{false};
+  /// @brief The current session had an error possibly caused by the baud rate.
+  bool baud_rate_error_{false};
+  /// @brief The current session tries a higher baud rate.
+  bool baud_rate_probing_{false};
+  /// @brief Sessions without errors since the last change of the baud rate.
+  uint32_t baud_rate_clean_sessions_{0};
+  /// @brief Clean sessions required before trying a higher rate.
+  uint32_t baud_rate_probe_sessions_{BAUD_RATE_PROBE_SESSIONS};
+  ESPPreferenceObject baud_rate_pref_;
+  /// @brief Meter sends P0 and expects password after option select.
+  bool password_required_{true};
+  /// @brief Parameters of the meter from the last successful session.
+  MeterCache meter_cache_{};
+  /// @brief @ref meter_cache_ holds valid data.
+  bool meter_cache_valid_{false};
+  ESPPreferenceObject meter_cache_pref_;
+  /// @brief Load profile rows waiting for publishing.
+  static const size_t PROFILE_QUEUE_SIZE = 16;
+  IEC62056TextSensor *profile_sensor_{nullptr};
+  LoadProfileParser profile_parser_;
+  /// @brief Rows from protocol to @c loop(). When full, the rest is read in the next session.
+  SPSCQueue<ProfileRow, PROFILE_QUEUE_SIZE> profile_rows_;
+  /// @brief Timestamp of the last row queued for publishing. Protocol side only.
+  ProfileCursor profile_cursor_{};
+  /// @brief Timestamp of the last published row, saved in preferences. @c loop() side only.
+  /// Rows still queued at reboot are read again.
+  ProfileCursor published_profile_cursor_{};
+  ESPPreferenceObject profile_cursor_pref_;
+  /// @brief Response to R5 command is being received.
+  bool profile_readout_{false};
+  /// @brief Buffer was full, rows are ignored until the end of response.
+  bool profile_overflow_{false};
+  size_t profile_rows_read_{0};
+  /// @brief R5 request, built at runtime because the cursor changes.
+  uint8_t profile_request_[4 + 5 + PROFILE_TIMESTAMP_LEN + 4];
 };
 
 }  // namespace iec62056
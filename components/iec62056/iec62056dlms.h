@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+namespace esphome {
+namespace iec62056 {
+
+/// @brief AARQ of public client: LN referencing, no security, GET only, max PDU 512 bytes
+static const uint8_t DLMS_AARQ[] = {
+    0x60, 0x1D,                                                        // AARQ
+    0xA1, 0x09, 0x06, 0x07, 0x60, 0x85, 0x74, 0x05, 0x08, 0x01, 0x01,  // application context name
+    0xBE, 0x10, 0x04, 0x0E,                                            // user information
+    0x01, 0x00, 0x00, 0x00, 0x06,                                      // xDLMS initiate request, version 6
+    0x5F, 0x1F, 0x04, 0x00, 0x00, 0x00, 0x10,                          // conformance: get
+    0x02, 0x00,                                                        // max receive PDU size
+};
+static const size_t DLMS_GET_REQUEST_SIZE = 13;
+/// Interface class Data, value without scaler
+static const uint16_t DLMS_CLASS_DATA = 1;
+/// Interface class Register, attribute 3 holds scaler and unit
+static const uint16_t DLMS_CLASS_REGISTER = 3;
+static const uint8_t DLMS_ATTRIBUTE_VALUE = 2;
+static const uint8_t DLMS_ATTRIBUTE_SCALER_UNIT = 3;
+/// Max length of formatted value
+static const size_t DLMS_MAX_TEXT_LEN = 40;
+
+/// @brief Builds GET request (normal) for attribute of an object.
+/// @param out @ref DLMS_GET_REQUEST_SIZE bytes
+inline size_t dlms_get_request(uint8_t *out, uint16_t class_id, const uint8_t ln[6], uint8_t attribute) {
+  out[0] = 0xC0;  // get-request
+  out[1] = 0x01;  // normal
+  out[2] = 0xC1;  // invoke id and priority
+  out[3] = class_id >> 8;
+  out[4] = class_id & 0xFF;
+  memcpy(out + 5, ln, 6);
+  out[11] = attribute;
+  out[12] = 0x00;  // no selective access
+  return DLMS_GET_REQUEST_SIZE;
+}
+
+/// @retval true AARE with result accepted
+inline bool dlms_aare_accepted(const uint8_t *apdu, size_t size) {
+  static const uint8_t ACCEPTED[] = {0xA2, 0x03, 0x02, 0x01, 0x00};
+  if (size < 2 || apdu[0] != 0x61)
+    return false;
+  for (size_t i = 2; i + sizeof(ACCEPTED) <= size; i++) {
+    if (0 == memcmp(apdu + i, ACCEPTED, sizeof(ACCEPTED)))
+      return true;
+  }
+  return false;
+}
+
+/// @brief Finds data in GET response (normal).
+/// @return Data starting with type tag, @c nullptr if the response holds an error
+inline const uint8_t *dlms_get_response_data(const uint8_t *apdu, size_t size, size_t &data_size) {
+  if (size < 5 || apdu[0] != 0xC4 || apdu[1] != 0x01 || apdu[3] != 0x00)
+    return nullptr;
+  data_size = size - 4;
+  return apdu + 4;
+}
+
+/// @brief Reads integer of any size as sign and magnitude, so long64-unsigned keeps all 64 bits.
+/// @retval false @a data is not an integer
+inline bool dlms_decode_integer(const uint8_t *data, size_t size, uint64_t &magnitude, bool &negative) {
+  size_t len;
+  bool is_signed;
+  switch (data[0]) {
+    case 0x03:  // boolean
+    case 0x11:  // unsigned
+    case 0x16:  // enum
+      len = 1;
+      is_signed = false;
+      break;
+    case 0x0F:  // integer
+      len = 1;
+      is_signed = true;
+      break;
+    case 0x10:  // long
+      len = 2;
+      is_signed = true;
+      break;
+    case 0x12:  // long-unsigned
+      len = 2;
+      is_signed = false;
+      break;
+    case 0x05:  // double-long
+      len = 4;
+      is_signed = true;
+      break;
+    case 0x06:  // double-long-unsigned
+      len = 4;
+      is_signed = false;
+      break;
+    case 0x14:  // long64
+      len = 8;
+      is_signed = true;
+      break;
+    case 0x15:  // long64-unsigned
+      len = 8;
+      is_signed = false;
+      break;
+    default:
+      return false;
+  }
+  if (size < 1 + len)
+    return false;
+  uint64_t u = 0;
+  for (size_t i = 0; i < len; i++) {
+    u = (u << 8) | data[1 + i];
+  }
+  negative = is_signed && ((u >> (8 * len - 1)) & 1);
+  if (negative) {
+    if (len < 8)
+      u |= ~0ULL << (8 * len);  // sign extension
+    u = 0 - u;  // two's complement, also for the most negative value
+  }
+  magnitude = u;
+  return true;
+}
+
+/// @brief Reads scaler from scaler_unit structure <tt>02 02 0F ss 16 uu</tt>.
+inline bool dlms_decode_scaler(const uint8_t *data, size_t size, int8_t &scaler) {
+  if (size < 6 || data[0] != 0x02 || data[1] != 0x02 || data[2] != 0x0F)
+    return false;
+  scaler = static_cast<int8_t>(data[3]);
+  return true;
+}
+
+/// @brief Formats value as text, integers are multiplied by 10^scaler.
+/// @param numeric set when the text is a number
+/// @return Length of null terminated text in @a out, 0 if the type is not supported
+inline size_t dlms_format_value(const uint8_t *data, size_t size, int8_t scaler, char *out, size_t out_size,
+                                bool &numeric) {
+  numeric = false;
+  if (size == 0)
+    return 0;
+  uint64_t u;
+  bool negative;
+  if (dlms_decode_integer(data, size, u, negative)) {
+    // digits in reverse order, scaled without floating point
+    char digits[24];
+    size_t n = 0;
+    do {
+      digits[n++] = '0' + u % 10;
+      u /= 10;
+    } while (u);
+    int point = scaler < 0 ? -scaler : 0;
+    while (n <= static_cast<size_t>(point) && n < sizeof(digits))
+      digits[n++] = '0';
+    size_t len = 0;
+    if (negative && len + 1 < out_size)
+      out[len++] = '-';
+    while (n > 0 && len + 1 < out_size) {
+      out[len++] = digits[--n];
+      if (point > 0 && n == static_cast<size_t>(point) && len + 1 < out_size)
+        out[len++] = '.';
+    }
+    for (int i = 0; i < scaler && len + 1 < out_size; i++)
+      out[len++] = '0';
+    out[len] = 0;
+    numeric = true;
+    return len;
+  }
+
+  switch (data[0]) {
+    case 0x17:    // float32
+    case 0x18: {  // float64
+      double value;
+      if (data[0] == 0x17 && size >= 5) {
+        uint32_t bits = (data[1] << 24) | (data[2] << 16) | (data[3] << 8) | data[4];
+        float f;
+        memcpy(&f, &bits, sizeof(f));
+        value = f;
+      } else if (data[0] == 0x18 && size >= 9) {
+        uint64_t bits = 0;
+        for (size_t i = 1; i < 9; i++)
+          bits = (bits << 8) | data[i];
+        memcpy(&value, &bits, sizeof(value));
+      } else {
+        return 0;
+      }
+      numeric = true;
+      return snprintf(out, out_size, "%g", value * pow(10, scaler));
+    }
+
+    case 0x09:    // octet-string
+    case 0x0A:    // visible-string
+    case 0x0C: {  // utf8-string
+      if (size < 2 || data[1] >= 0x80 || size < 2u + data[1])
+        return 0;  // long strings are not supported
+      size_t len = 0;
+      for (size_t i = 0; i < data[1] && len + 3 <= out_size; i++) {
+        if (data[0] == 0x09) {
+          len += snprintf(out + len, out_size - len, "%02X", data[2 + i]);
+        } else {
+          out[len++] = data[2 + i];
+        }
+      }
+      out[len] = 0;
+      return len;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+}  // namespace iec62056
+}  // namespace esphome
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+namespace esphome {
+namespace iec62056 {
+
+static const uint8_t SOH = 0x01;
+static const uint8_t STX = 0x02;
+static const uint8_t ETX = 0x03;
+static const uint8_t EOT = 0x04;
+static const uint8_t ACK = 0x06;
+static const uint8_t NAK = 0x15;
+
+/// @brief Updates CRC-16/ARC (polynomial 0xA001 reflected, initial value 0) with one byte.
+///
+/// Used by DSMR/P1 telegrams, computed from '/' to '!' inclusive.
+/// Nibble table, 32 bytes instead of 512.
+inline uint16_t crc16_arc_update(uint16_t crc, uint8_t c) {
+  static const uint16_t TABLE[16] = {0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+                                     0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400};
+  crc = (crc >> 4) ^ TABLE[(crc ^ c) & 0x0F];
+  crc = (crc >> 4) ^ TABLE[(crc ^ (c >> 4)) & 0x0F];
+  return crc;
+}
+
+/// @brief Frame terminator detected by @ref FrameAssembler::push()
+enum FrameEnd {
+  FRAME_NONE,
+  /// ACK received
+  FRAME_ACK,
+  /// STX received, data block begins
+  FRAME_STX,
+  /// ETX followed by BCC received
+  FRAME_ETX,
+  /// EOT followed by BCC received, partial block, more blocks follow
+  FRAME_EOT,
+  /// End of line \r\n
+  FRAME_CRLF,
+};
+
+/// @brief Circular frame assembler.
+///
+/// Collects received bytes in a ring buffer and detects frame terminators.
+/// Every byte costs O(1). When the frame is longer than the buffer, the oldest
+/// bytes are overwritten, so the buffer always holds the tail of the frame.
+///
+/// The assembler works on external storage. After a terminator is detected
+/// @ref linearize() moves the frame to the beginning of the storage, so
+/// the caller can use it as a plain array.
+class FrameAssembler {
+ public:
+  FrameAssembler(uint8_t *buf, size_t capacity) : buf_(buf), capacity_(capacity) {}
+
+  /// @brief Appends one byte to the frame.
+  /// @return Terminator detected with this byte or @c FRAME_NONE
+  FrameEnd push(uint8_t c) {
+    buf_[head_] = c;
+    if (++head_ == capacity_)
+      head_ = 0;
+    if (size_ < capacity_) {
+      size_++;
+    } else {
+      tail_ = head_;  // the oldest byte was overwritten
+    }
+
+    uint8_t prev = prev_;
+    prev_ = c;
+
+    // the order matches the priority of terminators, a BCC may have any value including ACK
+    if (size_ >= 2 && prev == ETX)
+      return FRAME_ETX;  // c is BCC
+    if (size_ >= 2 && prev == EOT)
+      return FRAME_EOT;  // c is BCC
+    if (c == ACK)
+      return FRAME_ACK;
+    if (c == STX)
+      return FRAME_STX;
+    if (size_ >= 2 && prev == '\r' && c == '\n')
+      return FRAME_CRLF;
+    return FRAME_NONE;
+  }
+
+  /// @brief Moves the frame to the beginning of the storage.
+  /// @return The size of the frame
+  size_t linearize() {
+    if (tail_ != 0) {
+      std::rotate(buf_, buf_ + tail_, buf_ + capacity_);
+      tail_ = 0;
+      head_ = size_ % capacity_;
+    }
+    return size_;
+  }
+
+  /// @brief The last received byte. Valid only if @ref size() > 0.
+  uint8_t last() const { return prev_; }
+
+  size_t size() const { return size_; }
+
+  /// @brief Discards the frame.
+  void reset() {
+    head_ = tail_ = size_ = 0;
+    prev_ = 0;
+  }
+
+ protected:
+  uint8_t *const buf_;
+  const size_t capacity_;
+  /// Index where the next byte is written
+  size_t head_{0};
+  /// Index of the oldest byte
+  size_t tail_{0};
+  /// Number of bytes in the frame
+  size_t size_{0};
+  /// The most recently received byte
+  uint8_t prev_{0};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
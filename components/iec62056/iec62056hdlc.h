@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace esphome {
+namespace iec62056 {
+
+static const uint8_t HDLC_FLAG = 0x7E;
+/// Frame format type 3, the lowest 3 bits and the next byte hold the length
+static const uint8_t HDLC_FORMAT = 0xA0;
+/// Segmentation bit of frame format, more segments of the information field follow
+static const uint8_t HDLC_SEGMENTED = 0x08;
+/// Control field with P/F bit set
+static const uint8_t HDLC_SNRM = 0x93;
+static const uint8_t HDLC_DISC = 0x53;
+static const uint8_t HDLC_UA = 0x73;
+/// Server address: upper HDLC address 1 (management logical device), one byte addressing
+static const uint8_t HDLC_SERVER_ADDRESS = (0x01 << 1) | 1;
+/// Client address: public client 16
+static const uint8_t HDLC_CLIENT_ADDRESS = (0x10 << 1) | 1;
+/// Max length of a frame between flags. Default max information field is 128 bytes.
+static const size_t HDLC_MAX_FRAME_SIZE = 160;
+/// Max length of reassembled APDU
+static const size_t HDLC_MAX_APDU_SIZE = 512;
+/// LLC header of frames sent by the client
+static const uint8_t HDLC_LLC_REQUEST[] = {0xE6, 0xE6, 0x00};
+/// LLC header of frames sent by the server
+static const uint8_t HDLC_LLC_RESPONSE[] = {0xE6, 0xE7, 0x00};
+
+/// FCS-16 lookup table (ISO/IEC 13239), reflected polynomial 0x8408
+static const uint16_t HDLC_FCS_TABLE[256] = {
+    0x0000, 0x1189, 0x2312, 0x329B, 0x4624, 0x57AD, 0x6536, 0x74BF,
+    0x8C48, 0x9DC1, 0xAF5A, 0xBED3, 0xCA6C, 0xDBE5, 0xE97E, 0xF8F7,
+    0x1081, 0x0108, 0x3393, 0x221A, 0x56A5, 0x472C, 0x75B7, 0x643E,
+    0x9CC9, 0x8D40, 0xBFDB, 0xAE52, 0xDAED, 0xCB64, 0xF9FF, 0xE876,
+    0x2102, 0x308B, 0x0210, 0x1399, 0x6726, 0x76AF, 0x4434, 0x55BD,
+    0xAD4A, 0xBCC3, 0x8E58, 0x9FD1, 0xEB6E, 0xFAE7, 0xC87C, 0xD9F5,
+    0x3183, 0x200A, 0x1291, 0x0318, 0x77A7, 0x662E, 0x54B5, 0x453C,
+    0xBDCB, 0xAC42, 0x9ED9, 0x8F50, 0xFBEF, 0xEA66, 0xD8FD, 0xC974,
+    0x4204, 0x538D, 0x6116, 0x709F, 0x0420, 0x15A9, 0x2732, 0x36BB,
+    0xCE4C, 0xDFC5, 0xED5E, 0xFCD7, 0x8868, 0x99E1, 0xAB7A, 0xBAF3,
+    0x5285, 0x430C, 0x7197, 0x601E, 0x14A1, 0x0528, 0x37B3, 0x263A,
+    0xDECD, 0xCF44, 0xFDDF, 0xEC56, 0x98E9, 0x8960, 0xBBFB, 0xAA72,
+    0x6306, 0x728F, 0x4014, 0x519D, 0x2522, 0x34AB, 0x0630, 0x17B9,
+    0xEF4E, 0xFEC7, 0xCC5C, 0xDDD5, 0xA96A, 0xB8E3, 0x8A78, 0x9BF1,
+    0x7387, 0x620E, 0x5095, 0x411C, 0x35A3, 0x242A, 0x16B1, 0x0738,
+    0xFFCF, 0xEE46, 0xDCDD, 0xCD54, 0xB9EB, 0xA862, 0x9AF9, 0x8B70,
+    0x8408, 0x9581, 0xA71A, 0xB693, 0xC22C, 0xD3A5, 0xE13E, 0xF0B7,
+    0x0840, 0x19C9, 0x2B52, 0x3ADB, 0x4E64, 0x5FED, 0x6D76, 0x7CFF,
+    0x9489, 0x8500, 0xB79B, 0xA612, 0xD2AD, 0xC324, 0xF1BF, 0xE036,
+    0x18C1, 0x0948, 0x3BD3, 0x2A5A, 0x5EE5, 0x4F6C, 0x7DF7, 0x6C7E,
+    0xA50A, 0xB483, 0x8618, 0x9791, 0xE32E, 0xF2A7, 0xC03C, 0xD1B5,
+    0x2942, 0x38CB, 0x0A50, 0x1BD9, 0x6F66, 0x7EEF, 0x4C74, 0x5DFD,
+    0xB58B, 0xA402, 0x9699, 0x8710, 0xF3AF, 0xE226, 0xD0BD, 0xC134,
+    0x39C3, 0x284A, 0x1AD1, 0x0B58, 0x7FE7, 0x6E6E, 0x5CF5, 0x4D7C,
+    0xC60C, 0xD785, 0xE51E, 0xF497, 0x8028, 0x91A1, 0xA33A, 0xB2B3,
+    0x4A44, 0x5BCD, 0x6956, 0x78DF, 0x0C60, 0x1DE9, 0x2F72, 0x3EFB,
+    0xD68D, 0xC704, 0xF59F, 0xE416, 0x90A9, 0x8120, 0xB3BB, 0xA232,
+    0x5AC5, 0x4B4C, 0x79D7, 0x685E, 0x1CE1, 0x0D68, 0x3FF3, 0x2E7A,
+    0xE70E, 0xF687, 0xC41C, 0xD595, 0xA12A, 0xB0A3, 0x8238, 0x93B1,
+    0x6B46, 0x7ACF, 0x4854, 0x59DD, 0x2D62, 0x3CEB, 0x0E70, 0x1FF9,
+    0xF78F, 0xE606, 0xD49D, 0xC514, 0xB1AB, 0xA022, 0x92B9, 0x8330,
+    0x7BC7, 0x6A4E, 0x58D5, 0x495C, 0x3DE3, 0x2C6A, 0x1EF1, 0x0F78,
+};
+static const uint16_t HDLC_FCS_INIT = 0xFFFF;
+/// FCS computed over a frame including its FCS
+static const uint16_t HDLC_FCS_GOOD = 0xF0B8;
+
+inline uint16_t hdlc_fcs_update(uint16_t fcs, uint8_t c) { return (fcs >> 8) ^ HDLC_FCS_TABLE[(fcs ^ c) & 0xFF]; }
+
+inline uint16_t hdlc_fcs(const uint8_t *data, size_t size) {
+  uint16_t fcs = HDLC_FCS_INIT;
+  for (size_t i = 0; i < size; i++) {
+    fcs = hdlc_fcs_update(fcs, data[i]);
+  }
+  return fcs ^ 0xFFFF;
+}
+
+/// @brief Event returned by @ref HdlcLink::push()
+enum HdlcEvent {
+  HDLC_NONE,
+  /// Frame without information field received, see @ref HdlcLink::control()
+  HDLC_CONTROL,
+  /// Segment of APDU received, send RR (@ref HdlcLink::build_rr()) to get the next one
+  HDLC_SEGMENT,
+  /// APDU complete, see @ref HdlcLink::apdu()
+  HDLC_APDU,
+  /// Invalid frame, FCS error or APDU too long. The frame is ignored.
+  HDLC_ERROR,
+};
+
+/// @brief HDLC link layer of IEC 62056-46 client.
+///
+/// Received bytes are pushed one at a time, FCS is computed while they arrive.
+/// Frames are delimited by the length in frame format field, so no byte stuffing
+/// is used and a flag may appear inside a frame. Segmented information fields
+/// are reassembled into one APDU without the LLC header.
+///
+/// Frames are built into a caller's buffer, see @ref max_frame_size().
+class HdlcLink {
+ public:
+  /// @brief Starts a new connection, sequence numbers are reset.
+  void reset() {
+    this->send_seq_ = 0;
+    this->recv_seq_ = 0;
+    this->apdu_size_ = 0;
+    this->in_frame_ = false;
+    this->size_ = 0;
+  }
+
+  /// @brief Buffer size needed by @ref build_info() for @a apdu_size bytes
+  static constexpr size_t max_frame_size(size_t apdu_size) { return 12 + sizeof(HDLC_LLC_REQUEST) + apdu_size; }
+
+  /// @brief Builds SNRM, DISC or another frame without information field.
+  /// @return Size of the frame in @a out
+  size_t build_control(uint8_t *out, uint8_t control) { return this->build_(out, control, nullptr, 0); }
+
+  /// @brief Builds I frame with @a apdu, LLC header is added.
+  size_t build_info(uint8_t *out, const uint8_t *apdu, size_t apdu_size) {
+    uint8_t control = (this->recv_seq_ << 5) | 0x10 | (this->send_seq_ << 1);
+    this->send_seq_ = (this->send_seq_ + 1) & 0x07;
+    this->apdu_size_ = 0;  // a new response follows
+    return this->build_(out, control, apdu, apdu_size);
+  }
+
+  /// @brief Builds RR asking for the next segment.
+  size_t build_rr(uint8_t *out) { return this->build_(out, (this->recv_seq_ << 5) | 0x11, nullptr, 0); }
+
+  /// @brief Appends one received byte.
+  HdlcEvent push(uint8_t c) {
+    if (!this->in_frame_) {
+      if (c == HDLC_FLAG) {
+        this->in_frame_ = true;
+        this->size_ = 0;
+        this->fcs_ = HDLC_FCS_INIT;
+      }
+      return HDLC_NONE;
+    }
+    if (this->size_ == 0 && c == HDLC_FLAG) {
+      return HDLC_NONE;  // closing flag of the previous frame or repeated flag
+    }
+
+    this->frame_[this->size_++] = c;
+    this->fcs_ = hdlc_fcs_update(this->fcs_, c);
+    if (this->size_ == 2) {
+      this->length_ = ((this->frame_[0] & 0x07) << 8) | this->frame_[1];
+      if ((this->frame_[0] & 0xF0) != HDLC_FORMAT || this->length_ < 7 || this->length_ > HDLC_MAX_FRAME_SIZE) {
+        this->in_frame_ = false;  // not a frame start, wait for the next flag
+        return HDLC_ERROR;
+      }
+    }
+    if (this->size_ < 2 || this->size_ < this->length_) {
+      return HDLC_NONE;
+    }
+
+    // the closing flag is not needed, it may be the opening flag of the next frame
+    this->in_frame_ = false;
+    if (this->fcs_ != HDLC_FCS_GOOD) {
+      return HDLC_ERROR;
+    }
+    return this->frame_received_();
+  }
+
+  /// @brief Control field of the last frame
+  uint8_t control() const { return this->control_; }
+  /// @brief Reassembled APDU, valid after @c HDLC_APDU
+  const uint8_t *apdu() const { return this->apdu_; }
+  size_t apdu_size() const { return this->apdu_size_; }
+
+ protected:
+  size_t build_(uint8_t *out, uint8_t control, const uint8_t *apdu, size_t apdu_size) {
+    size_t info_size = apdu ? sizeof(HDLC_LLC_REQUEST) + apdu_size : 0;
+    // format, addresses, control, HCS (only with information), information, FCS
+    size_t length = 2 + 2 + 1 + (info_size ? 2 + info_size : 0) + 2;
+    size_t n = 0;
+    out[n++] = HDLC_FLAG;
+    out[n++] = HDLC_FORMAT | ((length >> 8) & 0x07);
+    out[n++] = length & 0xFF;
+    out[n++] = HDLC_SERVER_ADDRESS;
+    out[n++] = HDLC_CLIENT_ADDRESS;
+    out[n++] = control;
+    if (info_size) {
+      n = this->append_fcs_(out, n);
+      memcpy(out + n, HDLC_LLC_REQUEST, sizeof(HDLC_LLC_REQUEST));
+      n += sizeof(HDLC_LLC_REQUEST);
+      memcpy(out + n, apdu, apdu_size);
+      n += apdu_size;
+    }
+    n = this->append_fcs_(out, n);
+    out[n++] = HDLC_FLAG;
+    return n;
+  }
+
+  /// FCS of everything after the opening flag, least significant byte first
+  static size_t append_fcs_(uint8_t *out, size_t n) {
+    uint16_t fcs = hdlc_fcs(out + 1, n - 1);
+    out[n++] = fcs & 0xFF;
+    out[n++] = fcs >> 8;
+    return n;
+  }
+
+  HdlcEvent frame_received_() {
+    if (this->frame_[2] != HDLC_CLIENT_ADDRESS) {
+      return HDLC_NONE;  // echo of a frame sent to the meter
+    }
+    // skip format, destination and source address of variable length
+    size_t pos = 2;
+    for (int address = 0; address < 2; address++) {
+      while (pos < this->length_ && !(this->frame_[pos] & 0x01))
+        pos++;
+      pos++;
+    }
+    if (pos + 3 > this->length_) {
+      return HDLC_ERROR;
+    }
+    this->control_ = this->frame_[pos++];
+    if (this->control_ & 0x01) {
+      return HDLC_CONTROL;  // supervisory or unnumbered frame
+    }
+
+    // I frame: HCS, information, FCS
+    if (pos + 4 > this->length_) {
+      return HDLC_ERROR;
+    }
+    this->recv_seq_ = ((this->control_ >> 1) + 1) & 0x07;
+    const uint8_t *info = this->frame_ + pos + 2;
+    size_t info_size = this->length_ - pos - 2 - 2;
+    if (this->apdu_size_ == 0 && info_size >= sizeof(HDLC_LLC_RESPONSE) &&
+        0 == memcmp(info, HDLC_LLC_RESPONSE, sizeof(HDLC_LLC_RESPONSE))) {
+      info += sizeof(HDLC_LLC_RESPONSE);
+      info_size -= sizeof(HDLC_LLC_RESPONSE);
+    }
+    if (this->apdu_size_ + info_size > HDLC_MAX_APDU_SIZE) {
+      this->apdu_size_ = 0;
+      return HDLC_ERROR;
+    }
+    memcpy(this->apdu_ + this->apdu_size_, info, info_size);
+    this->apdu_size_ += info_size;
+    return (this->frame_[0] & HDLC_SEGMENTED) ? HDLC_SEGMENT : HDLC_APDU;
+  }
+
+  /// N(S) of the next I frame sent
+  uint8_t send_seq_{0};
+  /// N(S) of the next I frame expected
+  uint8_t recv_seq_{0};
+  uint8_t control_{0};
+  bool in_frame_{false};
+  uint16_t fcs_{HDLC_FCS_INIT};
+  /// Frame length from frame format field, flags excluded
+  size_t length_{0};
+  /// Bytes received after the opening flag
+  size_t size_{0};
+  uint8_t frame_[HDLC_MAX_FRAME_SIZE];
+  uint8_t apdu_[HDLC_MAX_APDU_SIZE];
+  size_t apdu_size_{0};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
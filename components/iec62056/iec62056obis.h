@@ -0,0 +1,162 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include "iec62056parser.h"
+
+namespace esphome {
+namespace iec62056 {
+
+/// @brief OBIS code @c A-B:C.D.E*F in binary form.
+///
+/// All textual forms of a code are normalized to the same value, so
+/// @c 1.8.0, @c 1-0:1.8.0*255 and @c 010800FF match each other:
+/// - a letter in a value group stands for a number: C=96, F=97, L=98, P=99
+/// - 8 hex digits are @c C.D.E*F
+/// - missing @c A-B matches any medium and channel
+/// - missing E is 0, missing F is 255
+///
+/// The same rules are implemented by @c normalize_obis() in @c __init__.py.
+struct ObisCode {
+  /// A-B not given
+  static const uint16_t ANY_AB = 0xFFFF;
+
+  /// C, D, E, F from the most significant byte. Sensors are sorted by this value.
+  uint32_t cdef{0};
+  /// A in the high byte, B in the low byte, or @ref ANY_AB
+  uint16_t ab{ANY_AB};
+
+  /// @brief The same C.D.E*F and A-B, unless A-B is missing in one of them
+  bool matches(const ObisCode &other) const {
+    return this->cdef == other.cdef && (this->ab == ANY_AB || other.ab == ANY_AB || this->ab == other.ab);
+  }
+
+  /// @brief Normalizes textual form.
+  /// @retval false not a valid OBIS code, @a code is not changed
+  static bool parse(const TextSpan &text, ObisCode &code) {
+    const char *p = text.data;
+    const char *end = text.end();
+    ObisCode result;
+
+    if (text.size == 8 && all_hex_(p, end)) {
+      for (; p != end; p++) {
+        result.cdef = (result.cdef << 4) | (isdigit(*p) ? *p - '0' : toupper(*p) - 'A' + 10);
+      }
+      code = result;
+      return true;
+    }
+
+    uint32_t a, b;
+    const char *q = p;
+    if (number_(q, end, a) && q != end && *q == '-') {
+      q++;
+      if (!number_(q, end, b) || q == end || *q != ':')
+        return false;
+      result.ab = (a << 8) | b;
+      p = q + 1;
+    }
+
+    uint32_t groups[3] = {0, 0, 0};
+    size_t n = 0;
+    while (true) {
+      if (n == 3 || !value_group_(p, end, groups[n++]))
+        return false;
+      if (p == end || *p == '*')
+        break;
+      if (*p++ != '.')
+        return false;
+    }
+    if (n < 2)
+      return false;
+
+    uint32_t f = 255;
+    if (p != end) {
+      p++;  // '*'
+      if (!number_(p, end, f) || p != end)
+        return false;
+    }
+    result.cdef = (groups[0] << 24) | (groups[1] << 16) | (groups[2] << 8) | f;
+    code = result;
+    return true;
+  }
+
+  static bool parse(const std::string &text, ObisCode &code) {
+    return parse(TextSpan(text.data(), text.size()), code);
+  }
+
+  /// @brief Logical name for DLMS. Missing A-B is 0-0 for abstract objects
+  /// (C is 96-99), otherwise 1-0 (electricity).
+  void to_logical_name(uint8_t ln[6]) const {
+    uint8_t c = this->cdef >> 24;
+    if (this->ab == ANY_AB) {
+      ln[0] = c >= 96 && c <= 99 ? 0 : 1;
+      ln[1] = 0;
+    } else {
+      ln[0] = this->ab >> 8;
+      ln[1] = this->ab & 0xFF;
+    }
+    for (size_t i = 0; i < 4; i++) {
+      ln[2 + i] = this->cdef >> (24 - 8 * i);
+    }
+  }
+
+ protected:
+  static bool all_hex_(const char *p, const char *end) {
+    for (; p != end; p++) {
+      if (!isxdigit(*p))
+        return false;
+    }
+    return true;
+  }
+
+  /// Decimal number 0-255, at least one digit
+  static bool number_(const char *&p, const char *end, uint32_t &value) {
+    const char *start = p;
+    value = 0;
+    while (p != end && isdigit(*p) && value <= 255) {
+      value = value * 10 + (*p++ - '0');
+    }
+    return p != start && value <= 255;
+  }
+
+  /// Number or one letter
+  static bool value_group_(const char *&p, const char *end, uint32_t &value) {
+    static const char LETTERS[] = "CFLP";
+    if (p != end && *p != 0 && strchr(LETTERS, *p)) {
+      value = 96 + (strchr(LETTERS, *p) - LETTERS);
+      p++;
+      return p == end || *p == '.' || *p == '*';
+    }
+    return number_(p, end, value);
+  }
+};
+
+/// @brief Set of OBIS codes, may report false positives.
+///
+/// 256 bit map indexed by hash of C.D.E*F. Lines with codes not in
+/// the set are skipped right after the code, without a lookup.
+class ObisFilter {
+ public:
+  void add(const ObisCode &code) {
+    uint8_t bit = index_(code);
+    this->bits_[bit >> 5] |= 1UL << (bit & 31);
+  }
+
+  /// @retval false the code was never added
+  bool may_contain(const ObisCode &code) const {
+    uint8_t bit = index_(code);
+    return this->bits_[bit >> 5] & (1UL << (bit & 31));
+  }
+
+ protected:
+  /// Fibonacci hashing, the top byte depends on all bytes of the code
+  static uint8_t index_(const ObisCode &code) { return static_cast<uint32_t>(code.cdef * 2654435761UL) >> 24; }
+
+  uint32_t bits_[8]{};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
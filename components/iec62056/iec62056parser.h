@@ -0,0 +1,287 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <cctype>
+#include "iec62056frame.h"
+
+namespace esphome {
+namespace iec62056 {
+
+static const uint32_t FNV1A_OFFSET = 2166136261UL;
+static const uint32_t FNV1A_PRIME = 16777619UL;
+
+/// @brief Adds one character to FNV-1a hash
+inline uint32_t fnv1a_update(uint32_t hash, uint8_t c) { return (hash ^ c) * FNV1A_PRIME; }
+
+/// @brief Non-owning view of characters. Not null terminated.
+struct TextSpan {
+  TextSpan() = default;
+  TextSpan(const char *data, size_t size) : data(data), size(size) {}
+
+  const char *data{nullptr};
+  size_t size{0};
+
+  bool empty() const { return size == 0; }
+  const char *end() const { return data + size; }
+
+  /// @brief Three-way comparison, the same order as @c std::string::compare()
+  int compare(const char *str, size_t len) const {
+    size_t n = size < len ? size : len;
+    int r = n > 0 ? memcmp(data, str, n) : 0;
+    if (r != 0)
+      return r;
+    return size < len ? -1 : (size > len ? 1 : 0);
+  }
+  int compare(const std::string &str) const { return compare(str.data(), str.size()); }
+
+  /// @brief FNV-1a hash of the characters
+  uint32_t hash() const {
+    uint32_t h = FNV1A_OFFSET;
+    for (size_t i = 0; i < size; i++) {
+      h = fnv1a_update(h, data[i]);
+    }
+    return h;
+  }
+};
+
+/// Max length of a number. Safe value, in reality it is related to the number of digits on meter's display.
+static const size_t MAX_FLOAT_LEN = 20;
+/// Max length of OBIS code. Arbitrary chosen.
+static const size_t MAX_OBIS_LEN = 25;
+/// Max length of () group content. Longer values are truncated.
+static const size_t MAX_VALUE_LEN = 64;
+
+/// @brief Value group reported by @ref DataLineTokenizer.
+///
+/// Example: <tt>1-0:1.6.0(00000001000.000*kW)(2000-10-01 00:00:00)</tt>
+/// is reported as two groups with the same OBIS @c 1-0:1.6.0
+struct DataGroup {
+  TextSpan obis;
+  /// 1 for the first () group, 2 for the second
+  uint8_t index{0};
+  /// Content of the group including unit: @c 00000001000.000*kW
+  TextSpan value;
+  /// Unit: @c kW. Empty if no unit.
+  TextSpan unit;
+  /// Part before unit is a valid number
+  bool numeric{false};
+};
+
+/// @brief Event returned by @ref DataLineTokenizer::feed()
+enum TokenEvent {
+  TOKEN_NONE,
+  /// OBIS code complete, see @ref DataLineTokenizer::obis()
+  TOKEN_OBIS,
+  /// () group closed, see @ref DataLineTokenizer::group()
+  TOKEN_GROUP,
+  /// End of valid line (CR LF or ETX BCC)
+  TOKEN_LINE_END,
+  /// Invalid line, the rest of the line is ignored
+  TOKEN_ERROR,
+};
+
+/// @brief Incremental tokenizer for data lines.
+///
+/// Fed one byte at a time from the receive path. Validates characters as they
+/// arrive and reports each () group the moment its closing bracket is received.
+/// Only OBIS and the current group are stored, not the entire line, so lines
+/// of any length and any number of groups use the same memory.
+///
+/// A line may be split between partial blocks (<tt>EOT BCC</tt> ... @c STX),
+/// the tokenizer resumes it after STX of the next block. The object is cheap to
+/// copy, so the caller can save it at the beginning of a block and restore it
+/// when the block is repeated. It holds no pointers, spans are built from
+/// offsets when requested, so a copy never refers to buffers of the original.
+class DataLineTokenizer {
+ public:
+  TokenEvent feed(uint8_t c) {
+    if (this->state_ == SKIP_BCC) {
+      // BCC can be any byte, even a control character
+      this->state_ = OBIS;
+      return this->pending_;
+    }
+    if (this->state_ == SKIP_BLOCK_BCC) {
+      this->state_ = BLOCK_GAP;
+      return TOKEN_NONE;
+    }
+    if (this->state_ == BLOCK_GAP) {
+      if (c == STX)
+        this->state_ = this->resume_state_;
+      return TOKEN_NONE;
+    }
+
+    switch (c) {
+      case '\r':
+      case ACK:
+      case NAK:
+        // echo of ACK/NAK sent between blocks
+        return TOKEN_NONE;
+
+      case '\n':
+        return this->end_line_();
+
+      case STX:
+        this->reset();
+        return TOKEN_NONE;
+
+      case ETX:
+        // line ends with BCC, report it after BCC is received
+        this->pending_ = this->end_line_();
+        this->state_ = SKIP_BCC;
+        return TOKEN_NONE;
+
+      case EOT:
+        // partial block, the line may continue in the next block
+        this->resume_state_ = this->state_;
+        this->state_ = SKIP_BLOCK_BCC;
+        return TOKEN_NONE;
+    }
+
+    switch (this->state_) {
+      case SKIP_BCC:
+      case SKIP_BLOCK_BCC:
+      case BLOCK_GAP:
+      case SKIP_LINE:
+        return TOKEN_NONE;
+
+      case OBIS:
+        if (c == '(') {
+          this->index_ = 0;
+          this->open_group_();
+          return TOKEN_OBIS;
+        }
+        if (c == '!' && this->obis_len_ == 0) {
+          this->state_ = SKIP_LINE;  // end of data
+          return TOKEN_NONE;
+        }
+        if (this->obis_len_ < MAX_OBIS_LEN && is_obis_char_(c)) {
+          this->obis_[this->obis_len_++] = c;
+          return TOKEN_NONE;
+        }
+        this->state_ = SKIP_LINE;
+        return TOKEN_ERROR;
+
+      case VALUE:
+      case UNIT:
+        if (c == ')') {
+          this->has_unit_ = this->state_ == UNIT;
+          this->numeric_ = this->numeric_ && this->number_len_ > 0 && this->number_len_ <= MAX_FLOAT_LEN;
+          this->state_ = BETWEEN_GROUPS;
+          return TOKEN_GROUP;
+        }
+        if (this->state_ == VALUE) {
+          if (c == '*') {
+            this->state_ = UNIT;
+            this->unit_pos_ = this->value_len_ + 1;
+          } else {
+            this->numeric_ = this->numeric_ && (isdigit(c) || c == '.' || c == '-');
+            this->number_len_++;
+          }
+        }
+        if (this->value_len_ < MAX_VALUE_LEN) {
+          this->value_[this->value_len_++] = c;
+        }
+        return TOKEN_NONE;
+
+      case BETWEEN_GROUPS:
+        if (c == '(') {
+          this->open_group_();
+        }
+        return TOKEN_NONE;
+    }
+    return TOKEN_NONE;
+  }
+
+  /// @brief Starts a new line.
+  void reset() {
+    this->state_ = OBIS;
+    this->obis_len_ = 0;
+    this->index_ = 0;
+  }
+
+  /// @brief OBIS code of the current line. Valid after @c TOKEN_OBIS.
+  TextSpan obis() const { return TextSpan(this->obis_, this->obis_len_); }
+  /// @brief Ignores the rest of the current line. Called after @c TOKEN_OBIS
+  /// when nobody is interested in the values.
+  void skip_line() { this->state_ = SKIP_LINE; }
+  /// @brief The last closed group. Valid after @c TOKEN_GROUP until the next byte is fed.
+  DataGroup group() const {
+    DataGroup group;
+    group.obis = this->obis();
+    group.index = this->index_;
+    group.value = TextSpan(this->value_, this->value_len_);
+    if (this->has_unit_) {
+      group.unit = TextSpan(this->value_ + this->unit_pos_, this->value_len_ - this->unit_pos_);
+    }
+    group.numeric = this->numeric_;
+    return group;
+  }
+
+ protected:
+  enum State {
+    OBIS,
+    VALUE,
+    UNIT,
+    BETWEEN_GROUPS,
+    /// ETX received, the next byte is BCC
+    SKIP_BCC,
+    /// EOT received, the next byte is BCC of the partial block
+    SKIP_BLOCK_BCC,
+    /// Waiting for STX of the next block, then @ref resume_state_ continues
+    BLOCK_GAP,
+    /// Invalid or not interesting line
+    SKIP_LINE,
+  };
+
+  /// Valid OBIS codes may contain digits and uppercase letters
+  static bool is_obis_char_(uint8_t c) {
+    return c == ':' || c == '.' || c == '-' || c == '*' || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z');
+  }
+
+  void open_group_() {
+    this->state_ = VALUE;
+    if (this->index_ < UINT8_MAX)
+      this->index_++;
+    this->value_len_ = 0;
+    this->unit_pos_ = 0;
+    this->number_len_ = 0;
+    this->numeric_ = true;
+  }
+
+  TokenEvent end_line_() {
+    // no () group at all is an invalid line, empty line is ignored
+    bool invalid = this->state_ == OBIS && this->obis_len_ > 0;
+    bool empty = this->state_ == OBIS && this->obis_len_ == 0;
+    bool skipped = this->state_ == SKIP_LINE;
+    this->reset();
+    if (invalid)
+      return TOKEN_ERROR;
+    return empty || skipped ? TOKEN_NONE : TOKEN_LINE_END;
+  }
+
+  State state_{OBIS};
+  /// State interrupted by the end of a partial block
+  State resume_state_{OBIS};
+  /// Event reported after BCC
+  TokenEvent pending_{TOKEN_NONE};
+  char obis_[MAX_OBIS_LEN];
+  size_t obis_len_{0};
+  char value_[MAX_VALUE_LEN];
+  size_t value_len_{0};
+  /// Index of unit in @ref value_, valid in @c UNIT state
+  size_t unit_pos_{0};
+  /// Number of characters before unit
+  size_t number_len_{0};
+  /// All characters before unit are valid for a number. After @c TOKEN_GROUP the group is a number.
+  bool numeric_{true};
+  /// 1 for the first () group of the line
+  uint8_t index_{0};
+  /// The last closed group has unit at @ref unit_pos_
+  bool has_unit_{false};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include "iec62056parser.h"
+
+namespace esphome {
+namespace iec62056 {
+
+/// Length of load profile timestamp @c YYMMDDhhmm
+static const size_t PROFILE_TIMESTAMP_LEN = 10;
+
+/// @brief One row of load profile: timestamp followed by () groups.
+///
+/// Example: <tt>2406011015(0.123*kW)(0.000*kW)</tt>. Longer rows are truncated.
+struct ProfileRow {
+  static const size_t MAX_SIZE = 64;
+  char text[MAX_SIZE];
+};
+
+/// @brief Converts load profile response (P.01) into rows with timestamps.
+///
+/// Fed with events of @ref DataLineTokenizer. The response starts with a header line
+/// <tt>P.01(ZSYYMMDDhhmm)(SSSS)(RP)(z)(KZ1)(E1)...</tt> followed by value lines
+/// <tt>(v1)(v2)...</tt> without OBIS code. Only the header holds a timestamp, the
+/// timestamp of each next row is increased by the registration period @c RP.
+/// The header may repeat within the response, e.g. after status change.
+class LoadProfileParser {
+ public:
+  /// @brief Starts a new response.
+  void reset() {
+    this->in_header_ = false;
+    this->timestamp_valid_ = false;
+    this->row_len_ = 0;
+  }
+
+  /// @retval true row complete, see @ref row() and @ref timestamp()
+  bool process(TokenEvent event, const DataLineTokenizer &tokenizer) {
+    switch (event) {
+      case TOKEN_OBIS:
+        this->in_header_ = !tokenizer.obis().empty();
+        if (this->in_header_) {
+          this->timestamp_valid_ = false;
+          this->period_min_ = 0;
+        } else {
+          this->start_row_();
+        }
+        return false;
+
+      case TOKEN_GROUP:
+        if (this->in_header_) {
+          this->header_group_(tokenizer.group());
+        } else {
+          this->append_group_(tokenizer.group().value);
+        }
+        return false;
+
+      case TOKEN_LINE_END:
+        if (this->in_header_) {
+          this->in_header_ = false;
+          return false;
+        }
+        if (!this->timestamp_valid_ || this->row_len_ <= PROFILE_TIMESTAMP_LEN) {
+          return false;  // no header yet or empty row
+        }
+        memcpy(this->row_timestamp_, this->timestamp_, PROFILE_TIMESTAMP_LEN);
+        this->row_.text[this->row_len_] = 0;
+        this->timestamp_valid_ = this->period_min_ > 0 && add_minutes(this->timestamp_, this->period_min_);
+        return true;
+
+      default:
+        this->in_header_ = false;
+        return false;
+    }
+  }
+
+  /// @brief The last complete row, null terminated
+  const ProfileRow &row() const { return this->row_; }
+  /// @brief Timestamp of @ref row(), @c YYMMDDhhmm, not null terminated
+  const char *timestamp() const { return this->row_timestamp_; }
+
+  /// @brief Adds @a minutes to timestamp @c YYMMDDhhmm in place.
+  /// @retval false @a ts is not a valid timestamp
+  static bool add_minutes(char *ts, uint32_t minutes) {
+    uint32_t f[5];  // YY MM DD hh mm
+    for (size_t i = 0; i < 5; i++) {
+      if (!isdigit(ts[2 * i]) || !isdigit(ts[2 * i + 1]))
+        return false;
+      f[i] = (ts[2 * i] - '0') * 10 + (ts[2 * i + 1] - '0');
+    }
+    if (f[1] < 1 || f[1] > 12 || f[2] < 1)
+      return false;
+
+    uint32_t total = f[3] * 60 + f[4] + minutes;
+    f[4] = total % 60;
+    total /= 60;
+    f[3] = total % 24;
+    f[2] += total / 24;
+    while (f[2] > days_in_month_(f[0], f[1])) {
+      f[2] -= days_in_month_(f[0], f[1]);
+      if (++f[1] > 12) {
+        f[1] = 1;
+        f[0] = (f[0] + 1) % 100;
+      }
+    }
+
+    for (size_t i = 0; i < 5; i++) {
+      ts[2 * i] = '0' + f[i] / 10;
+      ts[2 * i + 1] = '0' + f[i] % 10;
+    }
+    return true;
+  }
+
+ protected:
+  static uint32_t days_in_month_(uint32_t year, uint32_t month) {
+    static const uint8_t DAYS[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    // two digit year, 2000-2099
+    return month == 2 && year % 4 == 0 ? 29 : DAYS[month - 1];
+  }
+
+  void header_group_(const DataGroup &group) {
+    if (group.index == 1 && group.value.size >= PROFILE_TIMESTAMP_LEN) {
+      // optional season digit before the timestamp
+      memcpy(this->timestamp_, group.value.end() - PROFILE_TIMESTAMP_LEN, PROFILE_TIMESTAMP_LEN);
+      char check[PROFILE_TIMESTAMP_LEN];
+      memcpy(check, this->timestamp_, PROFILE_TIMESTAMP_LEN);
+      this->timestamp_valid_ = add_minutes(check, 0);
+    } else if (group.index == 3) {
+      uint32_t period = 0;
+      for (const char *p = group.value.data; p != group.value.end() && isdigit(*p); p++) {
+        period = period * 10 + (*p - '0');
+      }
+      this->period_min_ = period;
+    }
+  }
+
+  void start_row_() {
+    memcpy(this->row_.text, this->timestamp_, PROFILE_TIMESTAMP_LEN);
+    this->row_len_ = PROFILE_TIMESTAMP_LEN;
+  }
+
+  void append_group_(const TextSpan &value) {
+    // '(' value ')' and null terminator
+    if (this->row_len_ + value.size + 3 > ProfileRow::MAX_SIZE)
+      return;
+    this->row_.text[this->row_len_++] = '(';
+    memcpy(this->row_.text + this->row_len_, value.data, value.size);
+    this->row_len_ += value.size;
+    this->row_.text[this->row_len_++] = ')';
+  }
+
+  bool in_header_{false};
+  /// @ref timestamp_ holds timestamp of the next row
+  bool timestamp_valid_{false};
+  char timestamp_[PROFILE_TIMESTAMP_LEN];
+  char row_timestamp_[PROFILE_TIMESTAMP_LEN];
+  /// Registration period in minutes
+  uint32_t period_min_{0};
+  ProfileRow row_;
+  size_t row_len_{0};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+namespace esphome {
+namespace iec62056 {
+
+/// @brief Lock-free single-producer/single-consumer queue.
+///
+/// One task calls only @ref push(), the other only @ref pop().
+/// Holds up to @a N - 1 items.
+template<typename T, size_t N> class SPSCQueue {
+ public:
+  /// @retval true item added
+  /// @retval false queue full
+  bool push(const T &item) {
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t next = (head + 1) % N;
+    if (next == tail_.load(std::memory_order_acquire))
+      return false;
+    items_[head] = item;
+    head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  /// @retval true @a item is valid
+  /// @retval false queue empty
+  bool pop(T &item) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire))
+      return false;
+    item = items_[tail];
+    tail_.store((tail + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+ protected:
+  T items_[N];
+  /// Written only by producer
+  std::atomic<size_t> head_{0};
+  /// Written only by consumer
+  std::atomic<size_t> tail_{0};
+};
+
+}  // namespace iec62056
+}  // namespace esphome
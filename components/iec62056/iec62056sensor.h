@@ -49,6 +49,11 @@ class IEC62056TextSensor : public IEC62056SensorBase, public text_sensor::TextSe
     has_value_ = true;
   }
 
+  void set_value(const char *value, size_t len) {
+    value_.assign(value, len);
+    has_value_ = true;
+  }
+
   void set_group(int group) { group_ = group % 3; }
 
   uint8_t get_group() { return group_; }
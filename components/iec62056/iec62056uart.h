@@ -8,63 +8,89 @@
 #ifdef USE_ESP32_FRAMEWORK_ARDUINO
 #include "esphome/components/uart/uart_component_esp32_arduino.h"
 #include <HardwareSerial.h>
+#include <driver/uart.h>
 #endif
 
 #ifdef USE_ESP8266
 #include "esphome/components/uart/uart_component_esp8266.h"
 #endif
 
+#include <algorithm>
+
 namespace esphome {
 namespace iec62056 {
 
-static const uint32_t TIMEOUT = 20;  // default value in uart implementation is 100ms
+#ifdef USE_ESP32
+/// @brief Sets 8N1 used by HDLC (Mode E) or the data format configured for @a uart.
+/// @remarks Call when TX is done.
+inline void set_uart_format(uart_port_t num, const uart::UARTComponent &uart, bool hdlc) {
+  uart_word_length_t bits = hdlc ? UART_DATA_8_BITS : (uart_word_length_t) (uart.get_data_bits() - 5);
+  uart_parity_t parity = UART_PARITY_DISABLE;
+  if (!hdlc && uart.get_parity() == uart::UART_CONFIG_PARITY_EVEN) {
+    parity = UART_PARITY_EVEN;
+  } else if (!hdlc && uart.get_parity() == uart::UART_CONFIG_PARITY_ODD) {
+    parity = UART_PARITY_ODD;
+  }
+  uart_set_word_length(num, bits);
+  uart_set_parity(num, parity);
+  uart_set_stop_bits(num, hdlc || uart.get_stop_bits() == 1 ? UART_STOP_BITS_1 : UART_STOP_BITS_2);
+}
+#endif
 
 #ifdef USE_ESP32_FRAMEWORK_ARDUINO
 
 class IEC62056UART final : public uart::ESP32ArduinoUARTComponent {
  public:
-  IEC62056UART(uart::ESP32ArduinoUARTComponent const &uart) : uart_(uart), hw_(uart.*(&IEC62056UART::hw_serial_)) {}
+  IEC62056UART(uart::ESP32ArduinoUARTComponent const &uart)
+      : uart_(uart), hw_(uart.*(&IEC62056UART::hw_serial_)), hw_num_(uart.*(&IEC62056UART::number_)) {}
 
   // Reconfigure baudrate
   void update_baudrate(uint32_t baudrate) { this->hw_->updateBaudRate(baudrate); }
 
-  /// @brief Reads one byte. Uses 20ms inter-character timeout.
+  /// @brief Switches between 8N1 for HDLC and the configured format.
+  void set_hdlc_format(bool hdlc) { set_uart_format((uart_port_t) this->hw_num_, this->uart_, hdlc); }
+
+  /// @brief Reads one byte if available. Never waits.
   /// @param data Pointer to one byte buffer to store data
   /// @retval true byte received
   /// @retval false no data
   /// @remarks
   /// Default @c read_byte() function waits 100 ms when no data in input buffer.
   /// This increase time spent in @c loop() function above accepted value (50ms).
-  /// Using the following implementation solves this problem. Higher level function
-  /// (@ref IEC62056Component::receive_frame_()) implements it's own timeout and can
-  /// properly handle fragmented packets.
-  bool read_one_byte(uint8_t *data) {
-    if (!this->check_read_timeout_quick_(1))
-      return false;
-    this->hw_->readBytes(data, 1);
-    return true;
+  /// Higher level function (@ref IEC62056Component::receive_frame_()) tracks
+  /// inter-character timeout and can properly handle fragmented packets.
+  bool read_one_byte(uint8_t *data) { return this->read_available(data, 1) == 1; }
+
+  /// @brief Reads all bytes already buffered by the driver, up to @a max.
+  /// @param dst Buffer to store data
+  /// @param max Size of @a dst
+  /// @return Number of bytes stored in @a dst, 0 if no data
+  /// @remarks
+  /// Never waits for data. One driver call instead of one call per byte.
+  size_t read_available(uint8_t *dst, size_t max) {
+    int avail = this->hw_->available();
+    if (avail <= 0 || max == 0)
+      return 0;
+    return this->hw_->readBytes(dst, std::min((size_t) avail, max));
   }
 
- protected:
-  /// @brief Helper function for @ref read_one_byte()
+  /// @brief Checks if all data was transmitted including the last stop bit.
   /// @remarks
-  /// Uses 20ms timeout instead of default 100ms.
-  bool check_read_timeout_quick_(size_t len) {
-    if (this->hw_->available() >= int(len))
-      return true;
+  /// Never waits. Use before changing baud rate, otherwise port get stuck.
+  bool is_tx_done() { return uart_wait_tx_done((uart_port_t) this->hw_num_, 0) == ESP_OK; }
 
-    uint32_t start_time = millis();
-    while (this->hw_->available() < int(len)) {
-      if (millis() - start_time > TIMEOUT) {
-        return false;
-      }
-      yield();
-    }
-    return true;
-  }
+  /// Called after data was written, the driver tracks TX state itself
+  void tx_started() {}
+
+  /// @brief Sleeps the protocol task until the next poll.
+  /// @remarks
+  /// There are no UART events with Arduino framework, data is polled every tick.
+  void wait_for_data(TickType_t ticks) { vTaskDelay(1); }
 
+ protected:
   uart::ESP32ArduinoUARTComponent const &uart_;
   HardwareSerial *const hw_;
+  const uint8_t hw_num_;
 };
 #endif
 
@@ -73,6 +99,11 @@ class IEC62056UART final : public uart::ESP32ArduinoUARTComponent {
 class XSoftSerial : public uart::ESP8266SoftwareSerial {
  public:
   void set_bit_time(uint32_t bt) { bit_time_ = bt; }
+  void set_format(uint8_t data_bits, uart::UARTParityOptions parity, uint8_t stop_bits) {
+    data_bits_ = data_bits;
+    parity_ = parity;
+    stop_bits_ = stop_bits;
+  }
 };
 
 class IEC62056UART final : public uart::ESP8266UartComponent {
@@ -86,49 +117,102 @@ class IEC62056UART final : public uart::ESP8266UartComponent {
     } else if (baudrate > 0) {
       ((XSoftSerial *) sw_)->set_bit_time(F_CPU / baudrate);
     }
+    if (baudrate > 0)
+      this->baudrate_ = baudrate;
   }
 
-  bool read_one_byte(uint8_t *data) {
+  /// @brief Switches between 8N1 for HDLC and the configured format.
+  /// @remarks
+  /// Hardware UART format is changed in its config register, @c begin() would reset the port.
+  void set_hdlc_format(bool hdlc) {
+    uint8_t data_bits = hdlc ? 8 : this->uart_.get_data_bits();
+    uart::UARTParityOptions parity = hdlc ? uart::UART_CONFIG_PARITY_NONE : this->uart_.get_parity();
+    uint8_t stop_bits = hdlc ? 1 : this->uart_.get_stop_bits();
+    if (this->hw_ == nullptr) {
+      ((XSoftSerial *) sw_)->set_format(data_bits, parity, stop_bits);
+      return;
+    }
+
+    uint32_t config = (data_bits - 5) << 2;  // UART_NB_BIT_5 .. UART_NB_BIT_8
+    if (parity == uart::UART_CONFIG_PARITY_EVEN) {
+      config |= UART_PARITY_EVEN;
+    } else if (parity == uart::UART_CONFIG_PARITY_ODD) {
+      config |= UART_PARITY_ODD;
+    }
+    config |= stop_bits == 2 ? UART_NB_STOP_BIT_2 : UART_NB_STOP_BIT_1;
+    const int num = this->hw_ == &Serial1 ? 1 : 0;
+    USC0(num) = (USC0(num) & ~UART_FORMAT_MASK) | config;
+  }
+
+  bool read_one_byte(uint8_t *data) { return this->read_available(data, 1) == 1; }
+
+  size_t read_available(uint8_t *dst, size_t max) {
     if (this->hw_ != nullptr) {
-      if (!this->check_read_timeout_quick_(1))
-        return false;
-      this->hw_->readBytes(data, 1);
-    } else {
-      if (sw_->available() < 1)
-        return false;
-      assert(this->sw_ != nullptr);
+      int avail = this->hw_->available();
+      if (avail <= 0 || max == 0)
+        return 0;
+      return this->hw_->readBytes(dst, std::min((size_t) avail, max));
+    }
+
+    // software serial buffers data in ISR, copy what is there
+    size_t n = 0;
+    while (n < max && this->sw_->available() > 0) {
       optional<uint8_t> b = this->sw_->read_byte();
-      if (b) {
-        *data = *b;
-      } else {
-        return false;
-      }
+      if (!b)
+        break;
+      dst[n++] = *b;
     }
-    return true;
+    return n;
   }
 
- protected:
-  bool check_read_timeout_quick_(size_t len) {
-    if (this->hw_->available() >= int(len))
+  /// @brief Checks if all data was transmitted including the last stop bit.
+  /// @remarks
+  /// Never waits. There is no TX done flag, so after TX FIFO becomes empty
+  /// one more character time is given to the shift register.
+  /// Software serial transmits synchronously, it is always done.
+  bool is_tx_done() {
+    if (this->hw_ == nullptr)
       return true;
 
-    uint32_t start_time = millis();
-    while (this->hw_->available() < int(len)) {
-      if (millis() - start_time > TIMEOUT) {
-        return false;
-      }
-      yield();
+    if (this->hw_->availableForWrite() < TX_FIFO_SIZE) {
+      this->tx_fifo_empty_ = false;
+      return false;
     }
-    return true;
+
+    if (!this->tx_fifo_empty_) {
+      this->tx_fifo_empty_ = true;
+      this->tx_fifo_empty_us_ = micros();
+    }
+    // 10 bits per character
+    return micros() - this->tx_fifo_empty_us_ >= 10 * 1000000UL / this->baudrate_;
   }
 
+  /// @brief Called after data was written.
+  /// @remarks
+  /// A short frame may leave TX FIFO before the next @ref is_tx_done() call,
+  /// the empty FIFO time of the previous frame must not be used then.
+  void tx_started() { this->tx_fifo_empty_ = false; }
+
+ protected:
+  /// Hardware TX FIFO of ESP8266 UART, the core does not export its size
+  static const int TX_FIFO_SIZE = 128;
+  /// Data bits, parity and stop bits fields of UART config register
+  static const uint32_t UART_FORMAT_MASK = 0x3F;
+
   uart::ESP8266UartComponent const &uart_;
   HardwareSerial *const hw_;               // hardware Serial
   uart::ESP8266SoftwareSerial *const sw_;  // software serial
+  uint32_t baudrate_{uart_.get_baud_rate()};
+  /// TX FIFO was empty at the last @ref is_tx_done() call
+  bool tx_fifo_empty_{false};
+  /// When TX FIFO became empty
+  uint32_t tx_fifo_empty_us_{0};
 };
 #endif
 
 #ifdef USE_ESP_IDF
+static const char *const UART_TAG = "iec62056.uart";
+
 class IEC62056UART final : public uart::IDFUARTComponent {
  public:
   IEC62056UART(uart::IDFUARTComponent &uart)
@@ -141,44 +225,141 @@ class IEC62056UART final : public uart::IDFUARTComponent {
     xSemaphoreGive(ilock_);
   }
 
-  bool read_one_byte(uint8_t *data) { return read_array_quick_(data, 1); }
+  /// @brief Switches between 8N1 for HDLC and the configured format.
+  void set_hdlc_format(bool hdlc) {
+    xSemaphoreTake(ilock_, portMAX_DELAY);
+    set_uart_format(this->iuart_num_, this->uart_, hdlc);
+    xSemaphoreGive(ilock_);
+  }
 
- protected:
-  bool check_read_timeout_quick_(size_t len) {
-    if (uart_.available() >= int(len))
-      return true;
+  bool read_one_byte(uint8_t *data) { return this->read_available(data, 1) == 1; }
 
-    uint32_t start_time = millis();
-    while (uart_.available() < int(len)) {
-      if (millis() - start_time > TIMEOUT) {
-        return false;
-      }
-      yield();
+  /// @brief Checks if all data was transmitted including the last stop bit.
+  /// @remarks
+  /// Never waits. Use before changing baud rate.
+  bool is_tx_done() { return uart_wait_tx_done(this->iuart_num_, 0) == ESP_OK; }
+
+  /// Called after data was written, the driver tracks TX state itself
+  void tx_started() {}
+
+  /// @brief Reinstalls UART driver with an event queue and LF pattern detection.
+  /// @retval true events enabled, @ref read_available() touches the driver only after an event
+  /// @retval false driver reinstall failed, UART is polled
+  /// @remarks
+  /// Pattern detection reports every complete line (LF). Frames ending with ETX+BCC or ACK
+  /// are reported by RX timeout event when the meter stops transmitting.
+  bool install_event_queue() {
+    xSemaphoreTake(this->ilock_, portMAX_DELAY);
+    uart_driver_delete(this->iuart_num_);
+    esp_err_t err = uart_driver_install(this->iuart_num_, this->uart_.get_rx_buffer_size(), 0, EVENT_QUEUE_SIZE,
+                                        &this->event_queue_, 0);
+    if (err == ESP_OK) {
+      uart_enable_pattern_det_baud_intr(this->iuart_num_, '\n', 1, 1, 0, 0);
+      uart_pattern_queue_reset(this->iuart_num_, EVENT_QUEUE_SIZE);
+      uart_set_rx_timeout(this->iuart_num_, RX_TIMEOUT_SYMBOLS);
+    } else {
+      ESP_LOGE(UART_TAG, "Failed to reinstall UART driver with event queue: %d", err);
+      this->event_queue_ = nullptr;
     }
-    return true;
+    xSemaphoreGive(this->ilock_);
+    return err == ESP_OK;
   }
 
-  bool read_array_quick_(uint8_t *data, size_t len) {
-    size_t length_to_read = len;
-    if (!this->check_read_timeout_quick_(len))
-      return false;
+  /// @brief Blocks the protocol task until a line, a frame or an overflow is reported, at most @a ticks.
+  /// @remarks
+  /// Without events data is polled every tick. Data already reported but not read means
+  /// the caller is not receiving now (e.g. waits for TX done), it sleeps one tick then.
+  void wait_for_data(TickType_t ticks) {
+    if (this->event_queue_ == nullptr || this->rx_ready_) {
+      vTaskDelay(1);
+      return;
+    }
+    uart_event_t event;
+    if (xQueuePeek(this->event_queue_, &event, ticks) == pdTRUE)
+      this->rx_ready_ = this->poll_events_();
+  }
+
+  size_t read_available(uint8_t *dst, size_t max) {
+    if (max == 0)
+      return 0;
+
+    // nothing landed since the driver was drained, skip lock and driver calls
+    if (!this->rx_ready_ && !this->poll_events_())
+      return 0;
+
+    size_t n = 0;
+    size_t buffered = 0;
     xSemaphoreTake(this->ilock_, portMAX_DELAY);
+    // data is read below, only release pattern positions
+    for (; this->patterns_ > 0; this->patterns_--)
+      uart_pattern_pop_pos(this->iuart_num_);
     if (this->has_peek_) {
-      length_to_read--;
-      *data = this->peek_byte_;
-      data++;
+      dst[n++] = this->peek_byte_;
       this->has_peek_ = false;
     }
-    if (length_to_read > 0)
-      uart_read_bytes(this->iuart_num_, data, length_to_read, 20 / portTICK_RATE_MS);
+    uart_get_buffered_data_len(this->iuart_num_, &buffered);
+    buffered = std::min(buffered, max - n);
+    if (buffered > 0) {
+      int len = uart_read_bytes(this->iuart_num_, dst + n, buffered, 0);
+      if (len > 0)
+        n += len;
+    }
     xSemaphoreGive(this->ilock_);
 
-    return true;
+    // keep reading until the driver is empty, no new event is sent for data already buffered
+    this->rx_ready_ = n > 0;
+    return n;
+  }
+
+ protected:
+  static const int EVENT_QUEUE_SIZE = 16;
+  /// RX timeout in symbols, reported when the line is idle after the last byte
+  static const uint8_t RX_TIMEOUT_SYMBOLS = 2;
+
+  /// @brief Drains event queue.
+  /// @retval true a line, a frame followed by idle line or overflow arrived
+  /// @remarks
+  /// Plain data events (RX FIFO threshold) do not wake the reader, it waits for the end of the line.
+  bool poll_events_() {
+    if (this->event_queue_ == nullptr)
+      return true;  // no events, poll driver every time
+
+    bool data = false;
+    uart_event_t event;
+    while (xQueueReceive(this->event_queue_, &event, 0) == pdTRUE) {
+      switch (event.type) {
+        case UART_PATTERN_DET:
+          // position is released by read_available() under the driver lock
+          this->patterns_++;
+          data = true;
+          break;
+
+        case UART_DATA:
+          data |= event.timeout_flag;
+          break;
+
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+          ESP_LOGW(UART_TAG, "UART RX overflow. Increase rx_buffer_size.");
+          data = true;
+          break;
+
+        default:
+          break;
+      }
+    }
+    return data;
   }
 
   uart::IDFUARTComponent &uart_;
   uart_port_t iuart_num_;
   SemaphoreHandle_t &ilock_;
+  /// UART driver event queue or @c nullptr when events are not used
+  QueueHandle_t event_queue_{nullptr};
+  /// Data may still be buffered in the driver
+  bool rx_ready_{true};
+  /// Pattern positions reported but not released yet
+  uint8_t patterns_{0};
 };
 #endif
 
@@ -1,17 +1,26 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import sensor
-from . import IEC62056Component, CONF_IEC62056_ID, CONF_OBIS, iec62056_ns, validate_obis
+from esphome.const import CONF_UPDATE_INTERVAL
+from . import IEC62056Component, CONF_IEC62056_ID, CONF_OBIS, iec62056_ns, validate_obis, register_request_obis, LOAD_PROFILE_OBIS
 
 IEC62056Sensor = iec62056_ns.class_("IEC62056Sensor", sensor.Sensor)
 
+
+def validate_not_load_profile(value):
+    if value == LOAD_PROFILE_OBIS:
+        raise cv.Invalid("Load profile rows can be published only by text sensor")
+    return value
+
+
 CONFIG_SCHEMA = cv.All(
     sensor.sensor_schema(
         IEC62056Sensor,
     ).extend(
         {
             cv.GenerateID(CONF_IEC62056_ID): cv.use_id(IEC62056Component),
-            cv.Required(CONF_OBIS): validate_obis,
+            cv.Required(CONF_OBIS): cv.All(validate_obis, validate_not_load_profile),
+            cv.Optional(CONF_UPDATE_INTERVAL): cv.update_interval,
         }
     ),
     cv.has_exactly_one_key(CONF_OBIS),
@@ -24,5 +33,6 @@ async def to_code(config):
 
     if CONF_OBIS in config:
         cg.add(var.set_obis(config[CONF_OBIS]))
+        register_request_obis(component, config)
 
     cg.add(component.register_sensor(var))
@@ -1,8 +1,8 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import text_sensor
-from esphome.const import CONF_GROUP
-from . import IEC62056Component, CONF_IEC62056_ID, CONF_OBIS, iec62056_ns, validate_obis
+from esphome.const import CONF_GROUP, CONF_UPDATE_INTERVAL
+from . import IEC62056Component, CONF_IEC62056_ID, CONF_OBIS, iec62056_ns, validate_obis, register_request_obis, LOAD_PROFILE_OBIS
 
 AUTO_LOAD = ["iec62056"]
 
@@ -15,6 +15,7 @@ CONFIG_SCHEMA = cv.All(
         {
             cv.GenerateID(CONF_IEC62056_ID): cv.use_id(IEC62056Component),
             cv.Required(CONF_OBIS): validate_obis,
+            cv.Optional(CONF_UPDATE_INTERVAL): cv.update_interval,
             cv.Optional(CONF_GROUP, default=1): cv.int_range(min=0, max=2),
         }
     ),
@@ -28,8 +29,14 @@ async def to_code(config):
 
     if CONF_OBIS in config:
         cg.add(var.set_obis(config[CONF_OBIS]))
+        register_request_obis(component, config)
 
     if CONF_GROUP in config:
         cg.add(var.set_group(config[CONF_GROUP]))
 
+    if config.get(CONF_OBIS) == LOAD_PROFILE_OBIS:
+        # publishes every row of load profile
+        cg.add(component.set_load_profile_sensor(var))
+        return
+
     cg.add(component.register_sensor(var))